@@ -39,21 +39,28 @@ static void callback(const event_type ev, void* client, const void* in,
   }
 }
 
-static int g_interruped;
-
-void signal_handler(int sig) { g_interruped = 1; }
+static void on_signal(void* watcher, int signo, void* arg) {
+  *(int*)arg = 0;
+}
 
 int main(int argc, char* argv[]) {
-  signal(SIGINT, signal_handler);
+  int running = 1;
 
   tcp_context_params params = {
       .port = 9000, .max_client_count = 10, .callback = callback};
 
   void* ctx = tcp_context_create(params);
+  if (!ctx) {
+    return 1;
+  }
+
+  // signals are read on the loop, no handler runs asynchronously
+  tcp_context_watch_signal(ctx, SIGINT, on_signal, &running);
+  tcp_context_watch_signal(ctx, SIGTERM, on_signal, &running);
 
   printf("server started\n");
 
-  while (!g_interruped) {
+  while (running) {
     tcp_context_service(ctx, -1);
   }
 
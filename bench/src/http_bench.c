@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "http_server.h"
+
+#define PORT 9110
+#define MAX_CONNECTIONS 64
+
+static const char kRequest[] =
+    "GET /plaintext HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "User-Agent: socev-bench\r\n"
+    "Accept: text/plain\r\n"
+    "\r\n";
+static const char kBody[] = "Hello, World!";
+static const char kResponseHeaders[] = "Content-Type: text/plain\r\n";
+
+static int g_connections = 16;
+static int g_depth = 16;
+static int g_seconds = 3;
+static atomic_int g_done;
+static uint64_t g_requests;
+
+static void on_request(void* req) {
+  http_respond(req, 200, kResponseHeaders, kBody, sizeof(kBody) - 1);
+}
+
+static void* load_thread(void* arg) {
+  int fds[MAX_CONNECTIONS];
+  const size_t response_size =
+      strlen("HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\n") +
+      strlen(kResponseHeaders) + sizeof(kBody) - 1;
+  const size_t batch_size = (sizeof(kRequest) - 1) * g_depth;
+  char* batch = (char*)malloc(batch_size);
+  char* responses = (char*)malloc(response_size * g_depth);
+
+  for (int i = 0; i < g_depth; ++i) {
+    memcpy(batch + i * (sizeof(kRequest) - 1), kRequest, sizeof(kRequest) - 1);
+  }
+
+  for (int i = 0; i < g_connections; ++i) {
+    fds[i] = bench_connect(PORT);
+    if (fds[i] == -1) {
+      fprintf(stderr, "cannot connect\n");
+      exit(1);
+    }
+  }
+
+  // every connection keeps `depth` requests pipelined
+  const uint64_t end = bench_now_ns() + (uint64_t)g_seconds * 1000000000ull;
+  while (bench_now_ns() < end) {
+    for (int i = 0; i < g_connections; ++i) {
+      bench_write_full(fds[i], batch, batch_size);
+    }
+    for (int i = 0; i < g_connections; ++i) {
+      if (bench_read_full(fds[i], responses, response_size * g_depth) == -1) {
+        fprintf(stderr, "short response\n");
+        exit(1);
+      }
+    }
+    g_requests += (uint64_t)g_connections * g_depth;
+  }
+
+  for (int i = 0; i < g_connections; ++i) {
+    close(fds[i]);
+  }
+  free(batch);
+  free(responses);
+
+  atomic_store(&g_done, 1);
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) g_connections = atoi(argv[1]);
+  if (argc > 2) g_depth = atoi(argv[2]);
+  if (argc > 3) g_seconds = atoi(argv[3]);
+  if (g_connections < 1 || g_connections > MAX_CONNECTIONS || g_depth < 1) {
+    fprintf(stderr, "usage: %s [connections<=%d] [pipeline depth] [seconds]\n",
+            argv[0], MAX_CONNECTIONS);
+    return 1;
+  }
+
+  http_server_params params = {.port = PORT,
+                               .max_client_count = MAX_CONNECTIONS,
+                               .max_pipelined = (uint32_t)g_depth,
+                               .on_request = on_request};
+  void* server = http_server_create(params);
+  if (!server) {
+    return 1;
+  }
+
+  pthread_t th;
+  const uint64_t start = bench_now_ns();
+  pthread_create(&th, NULL, load_thread, NULL);
+  while (!atomic_load(&g_done)) {
+    http_server_service(server, 10);
+  }
+  pthread_join(th, NULL);
+  const uint64_t elapsed = bench_now_ns() - start;
+
+  printf("connections %d, pipeline depth %d\n", g_connections, g_depth);
+  printf("%llu requests in %.2fs, %.0f requests/sec\n",
+         (unsigned long long)g_requests, elapsed / 1e9,
+         g_requests * 1e9 / elapsed);
+
+  http_server_destroy(server);
+  return 0;
+}
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "client.h"
+#include "payload.h"
+#include "tcp_context.h"
+
+#define PROXY_PORT 9120
+#define UPSTREAM_PORT 9121
+#define BLOCK_SIZE (256 * 1024)
+
+static uint64_t g_total = 1ull << 30;
+static int g_splice;
+static int g_upstream_fd;
+static atomic_int g_done;
+static void* g_ctx;
+
+static void proxy_callback(const event_type ev, void* client, const void* in,
+                           const uint32_t len) {
+  void* peer = client_get_user_data(client);
+
+  switch (ev) {
+    case EVT_CLIENT_CONNECTED:
+      if (!peer) {
+        peer = tcp_context_connect(g_ctx, "127.0.0.1", UPSTREAM_PORT);
+        client_set_user_data(client, peer);
+        client_set_user_data(peer, client);
+        if (g_splice) {
+          tcp_context_proxy(g_ctx, client, peer);
+        }
+      }
+      break;
+    case EVT_CLIENT_DATA_RECEIVED: {
+      // the copy path: recv buffer, payload, queued write
+      void* payload = payload_create(in, len);
+      client_enqueue(peer, payload);
+      payload_unref(payload);
+      client_flush(peer);
+    } break;
+    case EVT_CLIENT_DISCONNECTED:
+      if (peer) {
+        client_set_user_data(peer, NULL);
+        client_close(peer);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void* source_thread(void* arg) {
+  char* block = (char*)calloc(1, BLOCK_SIZE);
+  int fd = bench_connect(PROXY_PORT);
+  if (fd == -1) {
+    fprintf(stderr, "cannot connect to proxy\n");
+    exit(1);
+  }
+
+  uint64_t sent = 0;
+  while (sent < g_total) {
+    const size_t n = g_total - sent < BLOCK_SIZE ? g_total - sent : BLOCK_SIZE;
+    if (bench_write_full(fd, block, n) == -1) {
+      fprintf(stderr, "source write failed\n");
+      exit(1);
+    }
+    sent += n;
+  }
+
+  close(fd);
+  free(block);
+  return NULL;
+}
+
+static void* sink_thread(void* arg) {
+  char* block = (char*)malloc(BLOCK_SIZE);
+  uint64_t* received = (uint64_t*)arg;
+  int fd = accept(g_upstream_fd, NULL, NULL);
+
+  ssize_t n;
+  while ((n = read(fd, block, BLOCK_SIZE)) > 0) {
+    *received += n;
+  }
+
+  close(fd);
+  free(block);
+  atomic_store(&g_done, 1);
+  return NULL;
+}
+
+static void run(int splice_mode) {
+  tcp_context_params params = {.port = PROXY_PORT,
+                               .max_client_count = 4,
+                               .callback = proxy_callback};
+  pthread_t source, sink;
+  uint64_t received = 0;
+
+  g_splice = splice_mode;
+  g_ctx = tcp_context_create(params);
+  if (!g_ctx) {
+    exit(1);
+  }
+  atomic_store(&g_done, 0);
+
+  const uint64_t start = bench_now_ns();
+  const uint64_t cpu_start = bench_thread_cpu_ns();
+  pthread_create(&sink, NULL, sink_thread, &received);
+  pthread_create(&source, NULL, source_thread, NULL);
+  while (!atomic_load(&g_done)) {
+    tcp_context_service(g_ctx, 10);
+  }
+  const uint64_t cpu = bench_thread_cpu_ns() - cpu_start;
+  const uint64_t elapsed = bench_now_ns() - start;
+  pthread_join(source, NULL);
+  pthread_join(sink, NULL);
+
+  printf("%-7s %8.1f MiB/s %8.3f proxy cpu ns/byte %s\n",
+         splice_mode ? "splice" : "copy",
+         received / 1048576.0 / (elapsed / 1e9), (double)cpu / received,
+         received == g_total ? "" : "(short)");
+
+  tcp_context_destroy(g_ctx);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    g_total = strtoull(argv[1], NULL, 10) << 20;
+  }
+
+  // splice raises SIGPIPE when a side resets
+  signal(SIGPIPE, SIG_IGN);
+  g_upstream_fd = bench_listen(UPSTREAM_PORT);
+  if (g_upstream_fd == -1) {
+    fprintf(stderr, "cannot listen on upstream port\n");
+    return 1;
+  }
+
+  printf("forwarding %llu MiB through the proxy loop\n",
+         (unsigned long long)(g_total >> 20));
+  run(0);
+  run(1);
+
+  close(g_upstream_fd);
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "client.h"
+#include "replay.h"
+#include "tcp_context.h"
+
+#define PORT 9140
+#define CONNECTIONS 8
+#define LINES 20000
+#define CAPTURE_PATH "/tmp/socev_replay_bench.bin"
+
+static atomic_int g_done;
+static uint64_t g_lines;
+
+// the handler under test: counts newline terminated records and answers
+// each chunk, the kind of work a line protocol does per recv
+static void line_handler(const event_type ev, void* client, const void* in,
+                         const uint32_t len) {
+  if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    const char* p = (const char*)in;
+    const char* end = p + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+      g_lines++;
+      p++;
+    }
+    client_write(client, "ok\n", 3);
+  }
+}
+
+// irregular chunking, lines of varying length written in random batches
+static void* client_thread(void* arg) {
+  int fds[CONNECTIONS];
+  char buf[4096];
+  unsigned seed = 1;
+
+  for (int i = 0; i < CONNECTIONS; ++i) {
+    fds[i] = bench_connect(PORT);
+    if (fds[i] == -1) {
+      fprintf(stderr, "cannot connect\n");
+      exit(1);
+    }
+  }
+
+  for (int sent = 0; sent < LINES;) {
+    size_t len = 0;
+    const int batch = 1 + rand_r(&seed) % 16;
+    for (int b = 0; b < batch && sent < LINES; ++b, ++sent) {
+      const int line = 8 + rand_r(&seed) % 200;
+      memset(buf + len, 'a' + b, line);
+      len += line;
+      buf[len++] = '\n';
+    }
+    bench_write_full(fds[rand_r(&seed) % CONNECTIONS], buf, len);
+  }
+
+  // drain the replies so that closing does not reset unread input
+  for (int i = 0; i < CONNECTIONS; ++i) {
+    shutdown(fds[i], SHUT_WR);
+    while (read(fds[i], buf, sizeof(buf)) > 0) {
+    }
+    close(fds[i]);
+  }
+
+  atomic_store(&g_done, 1);
+  return NULL;
+}
+
+static void record(void) {
+  tcp_context_params params = {.port = PORT,
+                               .max_client_count = CONNECTIONS,
+                               .callback = line_handler};
+  pthread_t th;
+
+  void* ctx = tcp_context_create(params);
+  if (!ctx || tcp_context_capture_start(ctx, CAPTURE_PATH) == -1) {
+    exit(1);
+  }
+
+  atomic_store(&g_done, 0);
+  pthread_create(&th, NULL, client_thread, NULL);
+  while (!atomic_load(&g_done)) {
+    tcp_context_service(ctx, 10);
+  }
+  pthread_join(th, NULL);
+  while (tcp_context_service(ctx, 10) > 0) {
+  }
+
+  tcp_context_destroy(ctx);
+}
+
+static void replay(const char* path, replay_mode mode) {
+  replay_stats st;
+
+  g_lines = 0;
+  if (replay_run(path, line_handler, mode, &st) == -1) {
+    fprintf(stderr, "replay failed\n");
+    exit(1);
+  }
+
+  printf("%-8s %7llu events %9llu bytes %7llu lines  %8.1f ms wall  "
+         "%8.1f MiB/s handler  p50 %5llu ns  p99 %6llu ns  max %7llu ns\n",
+         mode == REPLAY_FAST ? "fast" : "realtime",
+         (unsigned long long)st.events, (unsigned long long)st.bytes,
+         (unsigned long long)g_lines, st.elapsed_ns / 1e6,
+         st.handler_ns ? st.bytes / 1048576.0 / (st.handler_ns / 1e9) : 0.0,
+         (unsigned long long)st.latency_p50_ns,
+         (unsigned long long)st.latency_p99_ns,
+         (unsigned long long)st.latency_max_ns);
+}
+
+int main(int argc, char* argv[]) {
+  // replay an existing capture, or record a synthetic one first
+  const char* path = argc > 1 ? argv[1] : CAPTURE_PATH;
+  if (argc <= 1) {
+    record();
+  }
+
+  replay(path, REPLAY_FAST);
+  replay(path, REPLAY_REALTIME);
+
+  if (argc <= 1) {
+    unlink(CAPTURE_PATH);
+  }
+  return 0;
+}
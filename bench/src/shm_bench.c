@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "client.h"
+#include "tcp_context.h"
+
+#define PORT 9160
+#define SHM_PATH "/tmp/socev_shm_bench.sock"
+#define UNIX_PATH "/tmp/socev_unix_bench.sock"
+#define PING_SIZE 64
+#define CHUNK (64 * 1024)
+
+static int g_pings = 20000;
+static uint64_t g_total = 256ull << 20;
+static uint32_t g_poll_us;
+
+static int cmp_u64(const void* a, const void* b) {
+  const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(const char* name, uint64_t* rtt, uint64_t bytes,
+                   uint64_t elapsed) {
+  qsort(rtt, g_pings, sizeof(uint64_t), cmp_u64);
+  printf("%-14s rtt p50 %7.2f us  p99 %7.2f us   echo %8.1f MiB/s\n", name,
+         rtt[g_pings / 2] / 1e3, rtt[g_pings * 99 / 100] / 1e3,
+         bytes / 1048576.0 / (elapsed / 1e9));
+}
+
+// the server side of the tcp and shm runs is a socev loop in a child
+static void echo_callback(const event_type ev, void* client, const void* in,
+                          const uint32_t len) {
+  if (ev != EVT_CLIENT_DATA_RECEIVED) {
+    return;
+  }
+
+  // links queue what the ring cannot take, a plain socket write does not
+  if (client_get_shm(client)) {
+    client_write(client, in, len);
+  } else {
+    client_write_zerocopy(client, in, len);
+  }
+}
+
+static volatile sig_atomic_t g_stop;
+
+static void on_term(int signo) { g_stop = 1; }
+
+static void* unix_echo_thread(void* arg) {
+  int listener = *(int*)arg;
+  char* buf = (char*)malloc(CHUNK);
+  int fd;
+
+  while ((fd = accept(listener, NULL, NULL)) != -1) {
+    ssize_t n;
+    while ((n = read(fd, buf, CHUNK)) > 0) {
+      if (bench_write_full(fd, buf, n) == -1) {
+        break;
+      }
+    }
+    close(fd);
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static void run_server(void) {
+  tcp_context_params params = {.port = PORT,
+                               .max_client_count = 8,
+                               .callback = echo_callback,
+                               .zerocopy_threshold = UINT32_MAX,
+                               .shm_path = SHM_PATH,
+                               .shm_poll_us = g_poll_us};
+  void* ctx = tcp_context_create(params);
+  if (!ctx) {
+    exit(1);
+  }
+
+  // unix sockets have no socev transport, a blocking echo stands in
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, UNIX_PATH);
+  unlink(UNIX_PATH);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(listener, 4) == -1) {
+    exit(1);
+  }
+  pthread_t unix_echo;
+  pthread_create(&unix_echo, NULL, unix_echo_thread, &listener);
+
+  signal(SIGTERM, on_term);
+  while (!g_stop) {
+    tcp_context_service(ctx, 10);
+  }
+
+  unlink(UNIX_PATH);
+  tcp_context_destroy(ctx);
+  _exit(0);
+}
+
+static void* stream_writer(void* arg) {
+  int fd = *(int*)arg;
+  char* buf = (char*)calloc(1, CHUNK);
+  uint64_t sent = 0;
+
+  while (sent < g_total) {
+    const size_t len = g_total - sent < CHUNK ? g_total - sent : CHUNK;
+    if (bench_write_full(fd, buf, len) == -1) {
+      break;
+    }
+    sent += len;
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static void run_socket(const char* name, int fd) {
+  uint64_t* rtt = (uint64_t*)malloc(g_pings * sizeof(uint64_t));
+  char ping[PING_SIZE] = {0};
+
+  for (int i = 0; i < g_pings; ++i) {
+    const uint64_t start = bench_now_ns();
+    if (bench_write_full(fd, ping, sizeof(ping)) == -1 ||
+        bench_read_full(fd, ping, sizeof(ping)) == -1) {
+      exit(1);
+    }
+    rtt[i] = bench_now_ns() - start;
+  }
+
+  char* buf = (char*)malloc(CHUNK);
+  uint64_t received = 0;
+  pthread_t writer;
+  const uint64_t start = bench_now_ns();
+  pthread_create(&writer, NULL, stream_writer, &fd);
+  while (received < g_total) {
+    const ssize_t n = read(fd, buf, CHUNK);
+    if (n <= 0) {
+      exit(1);
+    }
+    received += n;
+  }
+  const uint64_t elapsed = bench_now_ns() - start;
+  pthread_join(writer, NULL);
+
+  report(name, rtt, received, elapsed);
+  free(buf);
+  free(rtt);
+  close(fd);
+}
+
+// the shm client is a socev loop as well, the callback keeps one ping or a
+// window of the stream in flight
+static struct {
+  uint64_t* rtt;
+  int ping;
+  uint64_t ping_start;
+  uint32_t ping_got;
+  int streaming;
+  uint64_t sent;
+  uint64_t received;
+  char* chunk;
+} g_shm;
+
+static void send_ping(void* client) {
+  static const char ping[PING_SIZE];
+  g_shm.ping_got = 0;
+  g_shm.ping_start = bench_now_ns();
+  client_write(client, ping, sizeof(ping));
+}
+
+static void pump(void* client) {
+  while (g_shm.sent < g_total && !client_has_pending_output(client)) {
+    const uint32_t len =
+        g_total - g_shm.sent < CHUNK ? (uint32_t)(g_total - g_shm.sent) : CHUNK;
+    client_write(client, g_shm.chunk, len);
+    g_shm.sent += len;
+  }
+
+  if (g_shm.sent < g_total) {
+    client_callback_on_writable(client);
+  }
+}
+
+static void shm_callback(const event_type ev, void* client, const void* in,
+                         const uint32_t len) {
+  switch (ev) {
+    case EVT_CLIENT_CONNECTED:
+      send_ping(client);
+      break;
+    case EVT_CLIENT_DATA_RECEIVED:
+      if (g_shm.streaming) {
+        g_shm.received += len;
+        break;
+      }
+      g_shm.ping_got += len;
+      if (g_shm.ping_got < PING_SIZE) {
+        break;
+      }
+      g_shm.rtt[g_shm.ping++] = bench_now_ns() - g_shm.ping_start;
+      if (g_shm.ping < g_pings) {
+        send_ping(client);
+      }
+      break;
+    case EVT_CLIENT_WRITABLE:
+      pump(client);
+      break;
+    default:
+      break;
+  }
+}
+
+static void run_shm(const char* name) {
+  tcp_context_params params = {.port = PORT + 1,
+                               .max_client_count = 2,
+                               .callback = shm_callback,
+                               .shm_poll_us = g_poll_us};
+  memset(&g_shm, 0, sizeof(g_shm));
+  g_shm.rtt = (uint64_t*)malloc(g_pings * sizeof(uint64_t));
+  g_shm.chunk = (char*)calloc(1, CHUNK);
+
+  void* ctx = tcp_context_create(params);
+  void* client = ctx ? tcp_context_connect_shm(ctx, SHM_PATH) : NULL;
+  if (!client) {
+    exit(1);
+  }
+
+  while (g_shm.ping < g_pings) {
+    tcp_context_service(ctx, 10);
+  }
+
+  g_shm.streaming = 1;
+  const uint64_t start = bench_now_ns();
+  pump(client);
+  while (g_shm.received < g_total) {
+    tcp_context_service(ctx, 10);
+  }
+  const uint64_t elapsed = bench_now_ns() - start;
+
+  tcp_context_stats stats;
+  tcp_context_get_stats(ctx, &stats);
+  report(name, g_shm.rtt, g_shm.received, elapsed);
+  printf("%-14s %llu doorbells rung by the server\n", "",
+         (unsigned long long)stats.shm_doorbells);
+
+  tcp_context_destroy(ctx);
+  free(g_shm.chunk);
+  free(g_shm.rtt);
+}
+
+static int connect_unix(void) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, UNIX_PATH);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    exit(1);
+  }
+  return fd;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    g_poll_us = (uint32_t)strtoul(argv[1], NULL, 10);
+  }
+  if (argc > 2) {
+    g_total = strtoull(argv[2], NULL, 10) << 20;
+  }
+
+  const pid_t server = fork();
+  if (server == 0) {
+    run_server();
+  }
+
+  // wait for both listeners of the child
+  while (access(UNIX_PATH, F_OK) != 0 || access(SHM_PATH, F_OK) != 0) {
+    usleep(1000);
+  }
+
+  printf("%d pings of %d B, %llu MiB echoed in %d KiB writes, shm polling "
+         "%u us\n",
+         g_pings, PING_SIZE, (unsigned long long)(g_total >> 20), CHUNK / 1024,
+         g_poll_us);
+
+  int fd = bench_connect(PORT);
+  if (fd == -1) {
+    exit(1);
+  }
+  run_socket("tcp loopback", fd);
+  run_socket("unix socket", connect_unix());
+  run_shm("shm ring");
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  return 0;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "client.h"
+#include "tcp_context.h"
+
+#define TLS_PORT 9130
+#define BLOCK_SIZE (256 * 1024)
+#define FILE_SIZE (4 * 1024 * 1024)
+#define CERT_PATH "/tmp/socev_tls_bench_cert.pem"
+#define KEY_PATH "/tmp/socev_tls_bench_key.pem"
+
+static uint64_t g_total = 1ull << 30;
+static int g_sendfile;
+static int g_file_fd;
+static char* g_block;
+static uint64_t g_sent;
+static atomic_int g_done;
+
+static void write_cert(void) {
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* x509 = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+  X509_set_pubkey(x509, key);
+  X509_NAME* name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  X509_sign(x509, key, EVP_sha256());
+
+  FILE* f = fopen(CERT_PATH, "w");
+  PEM_write_X509(f, x509);
+  fclose(f);
+  f = fopen(KEY_PATH, "w");
+  PEM_write_PrivateKey(f, key, NULL, NULL, 0, NULL, NULL);
+  fclose(f);
+
+  X509_free(x509);
+  EVP_PKEY_free(key);
+}
+
+// pushes until the socket is full, then waits for EVT_CLIENT_WRITABLE
+static void pump(void* client) {
+  while (g_sent < g_total) {
+    const uint64_t left = g_total - g_sent;
+    ssize_t n;
+    if (g_sendfile) {
+      off_t off = g_sent % FILE_SIZE;
+      const size_t len = FILE_SIZE - off < left ? FILE_SIZE - off : left;
+      n = client_sendfile(client, g_file_fd, &off, len);
+    } else {
+      n = client_write(client, g_block, left < BLOCK_SIZE ? left : BLOCK_SIZE);
+    }
+
+    if (n <= 0 || client_has_pending_output(client)) {
+      if (n > 0) {
+        g_sent += n;
+      }
+      client_callback_on_writable(client);
+      return;
+    }
+    g_sent += n;
+  }
+
+  client_close(client);
+}
+
+static void tls_callback(const event_type ev, void* client, const void* in,
+                         const uint32_t len) {
+  switch (ev) {
+    case EVT_CLIENT_CONNECTED:
+    case EVT_CLIENT_WRITABLE:
+      pump(client);
+      break;
+    default:
+      break;
+  }
+}
+
+static void* sink_thread(void* arg) {
+  uint64_t* received = (uint64_t*)arg;
+  char* block = (char*)malloc(BLOCK_SIZE);
+  SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_client_method());
+  SSL* ssl = SSL_new(ssl_ctx);
+  int fd = bench_connect(TLS_PORT);
+
+  SSL_set_fd(ssl, fd);
+  if (fd == -1 || SSL_connect(ssl) != 1) {
+    fprintf(stderr, "tls connect failed\n");
+    exit(1);
+  }
+
+  // the sink always decrypts in userspace, only the server side varies
+  int n;
+  while ((n = SSL_read(ssl, block, BLOCK_SIZE)) > 0) {
+    *received += n;
+  }
+
+  SSL_free(ssl);
+  SSL_CTX_free(ssl_ctx);
+  close(fd);
+  free(block);
+  atomic_store(&g_done, 1);
+  return NULL;
+}
+
+static void run(int ktls, int sendfile_mode) {
+  tcp_context_params params = {.port = TLS_PORT,
+                               .max_client_count = 4,
+                               .callback = tls_callback,
+                               .options = ktls ? 0 : OPT_TLS_NO_KTLS,
+                               .tls_cert_file = CERT_PATH,
+                               .tls_key_file = KEY_PATH};
+  pthread_t sink;
+  uint64_t received = 0;
+
+  g_sendfile = sendfile_mode;
+  g_sent = 0;
+  atomic_store(&g_done, 0);
+
+  void* ctx = tcp_context_create(params);
+  if (!ctx) {
+    exit(1);
+  }
+
+  const uint64_t start = bench_now_ns();
+  const uint64_t cpu_start = bench_thread_cpu_ns();
+  pthread_create(&sink, NULL, sink_thread, &received);
+  while (!atomic_load(&g_done)) {
+    tcp_context_service(ctx, 10);
+  }
+  const uint64_t cpu = bench_thread_cpu_ns() - cpu_start;
+  const uint64_t elapsed = bench_now_ns() - start;
+  pthread_join(sink, NULL);
+
+  tcp_context_stats stats;
+  tcp_context_get_stats(ctx, &stats);
+  const char* mode = !ktls ? "user" : stats.tls_ktls_send ? "ktls" : "ktls*";
+
+  printf("%-6s %-9s %8.1f MiB/s %8.3f server cpu ns/byte %s\n", mode,
+         sendfile_mode ? "sendfile" : "write",
+         received / 1048576.0 / (elapsed / 1e9), (double)cpu / received,
+         received == g_total ? "" : "(short)");
+
+  tcp_context_destroy(ctx);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    g_total = strtoull(argv[1], NULL, 10) << 20;
+  }
+
+  // OpenSSL writes to the socket without MSG_NOSIGNAL
+  signal(SIGPIPE, SIG_IGN);
+  write_cert();
+
+  g_block = (char*)calloc(1, BLOCK_SIZE);
+  FILE* f = tmpfile();
+  if (!g_block || !f || ftruncate(fileno(f), FILE_SIZE) == -1) {
+    fprintf(stderr, "cannot create source data\n");
+    return 1;
+  }
+  g_file_fd = fileno(f);
+
+  printf("sending %llu MiB over loopback tls, ktls* means the kernel "
+         "refused the offload and userspace tls was used\n",
+         (unsigned long long)(g_total >> 20));
+  run(0, 0);
+  run(0, 1);
+  run(1, 0);
+  run(1, 1);
+
+  fclose(f);
+  free(g_block);
+  unlink(CERT_PATH);
+  unlink(KEY_PATH);
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "client.h"
+#include "tcp_context.h"
+
+#define PORT 9100
+#define CONNECTIONS 8
+#define MSG_SIZE 64
+#define ROUNDS 20000
+
+static atomic_int g_done;
+
+static void echo_callback(const event_type ev, void* client, const void* in,
+                          const uint32_t len) {
+  if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    client_write(client, in, len);
+  }
+}
+
+static void* client_thread(void* arg) {
+  int fds[CONNECTIONS];
+  char msg[MSG_SIZE];
+  char reply[MSG_SIZE];
+  memset(msg, 'x', sizeof(msg));
+
+  for (int i = 0; i < CONNECTIONS; ++i) {
+    fds[i] = bench_connect(PORT);
+    if (fds[i] == -1) {
+      fprintf(stderr, "cannot connect\n");
+      exit(1);
+    }
+  }
+
+  for (int r = 0; r < ROUNDS; ++r) {
+    for (int i = 0; i < CONNECTIONS; ++i) {
+      bench_write_full(fds[i], msg, sizeof(msg));
+    }
+    for (int i = 0; i < CONNECTIONS; ++i) {
+      bench_read_full(fds[i], reply, sizeof(reply));
+    }
+  }
+
+  for (int i = 0; i < CONNECTIONS; ++i) {
+    close(fds[i]);
+  }
+
+  atomic_store(&g_done, 1);
+  return NULL;
+}
+
+static void run(void* ctx, const char* name) {
+  pthread_t th;
+  atomic_store(&g_done, 0);
+
+  const uint64_t start = bench_now_ns();
+  pthread_create(&th, NULL, client_thread, NULL);
+  while (!atomic_load(&g_done)) {
+    tcp_context_service(ctx, 10);
+  }
+  pthread_join(th, NULL);
+  const uint64_t elapsed = bench_now_ns() - start;
+
+  // let the disconnects drain before the next run
+  while (tcp_context_service(ctx, 10) > 0) {
+  }
+
+  const double msgs = (double)ROUNDS * CONNECTIONS;
+  printf("%-16s %10.0f msg/s %8.1f ns/msg\n", name, msgs * 1e9 / elapsed,
+         (double)elapsed / msgs);
+}
+
+int main(int argc, char* argv[]) {
+  tcp_context_params params = {.port = PORT,
+                               .max_client_count = CONNECTIONS,
+                               .callback = echo_callback};
+
+  void* ctx = tcp_context_create(params);
+  if (!ctx) {
+    return 1;
+  }
+
+  run(ctx, "trace off");
+  tcp_context_trace_enable(ctx, 1 << 16);
+  run(ctx, "trace on");
+  tcp_context_trace_disable(ctx);
+  run(ctx, "trace toggled off");
+
+  if (argc > 1) {
+    tcp_context_trace_dump(ctx, argv[1]);
+  }
+
+  tcp_context_destroy(ctx);
+  return 0;
+}
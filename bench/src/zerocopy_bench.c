@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "client.h"
+#include "tcp_context.h"
+
+#define PORT 9150
+#define BUFFERS 16
+#define SINK_BLOCK (256 * 1024)
+
+static uint64_t g_total = 512ull << 20;
+static uint32_t g_size;
+static char* g_bufs[BUFFERS];
+static int g_busy[BUFFERS];
+static uint64_t g_sent;
+static atomic_int g_done;
+
+// keeps up to BUFFERS sends in flight, a copied buffer is free at once and a
+// pinned one only after EVT_CLIENT_SEND_COMPLETE
+static void pump(void* client) {
+  while (g_sent < g_total && !client_has_pending_output(client)) {
+    int i = 0;
+    while (i < BUFFERS && g_busy[i]) {
+      i++;
+    }
+    if (i == BUFFERS) {
+      return;
+    }
+
+    const uint32_t len =
+        g_total - g_sent < g_size ? (uint32_t)(g_total - g_sent) : g_size;
+    const int result = client_write_zerocopy(client, g_bufs[i], len);
+    if (result == -1) {
+      exit(1);
+    }
+    g_busy[i] = result == 0;
+    g_sent += len;
+  }
+
+  if (g_sent < g_total) {
+    client_callback_on_writable(client);
+  } else {
+    client_close(client);
+  }
+}
+
+static void zc_callback(const event_type ev, void* client, const void* in,
+                        const uint32_t len) {
+  switch (ev) {
+    case EVT_CLIENT_SEND_COMPLETE:
+      for (int i = 0; i < BUFFERS; ++i) {
+        if (g_bufs[i] == in) {
+          g_busy[i] = 0;
+        }
+      }
+      // fall through
+    case EVT_CLIENT_CONNECTED:
+    case EVT_CLIENT_WRITABLE:
+      pump(client);
+      break;
+    default:
+      break;
+  }
+}
+
+static void* sink_thread(void* arg) {
+  uint64_t* received = (uint64_t*)arg;
+  char* block = (char*)malloc(SINK_BLOCK);
+  int fd = bench_connect(PORT);
+  if (fd == -1) {
+    fprintf(stderr, "cannot connect\n");
+    exit(1);
+  }
+
+  ssize_t n;
+  while ((n = read(fd, block, SINK_BLOCK)) > 0) {
+    *received += n;
+  }
+
+  close(fd);
+  free(block);
+  atomic_store(&g_done, 1);
+  return NULL;
+}
+
+static void run(uint32_t size, int zerocopy) {
+  tcp_context_params params = {
+      .port = PORT,
+      .max_client_count = 4,
+      .callback = zc_callback,
+      .zerocopy_threshold = zerocopy ? 1 : UINT32_MAX};
+  pthread_t sink;
+  uint64_t received = 0;
+
+  g_size = size;
+  g_sent = 0;
+  memset(g_busy, 0, sizeof(g_busy));
+  atomic_store(&g_done, 0);
+
+  void* ctx = tcp_context_create(params);
+  if (!ctx) {
+    exit(1);
+  }
+
+  const uint64_t start = bench_now_ns();
+  const uint64_t cpu_start = bench_thread_cpu_ns();
+  pthread_create(&sink, NULL, sink_thread, &received);
+  while (!atomic_load(&g_done)) {
+    tcp_context_service(ctx, 10);
+  }
+  const uint64_t cpu = bench_thread_cpu_ns() - cpu_start;
+  const uint64_t elapsed = bench_now_ns() - start;
+  pthread_join(sink, NULL);
+
+  tcp_context_stats stats;
+  tcp_context_get_stats(ctx, &stats);
+
+  printf("%7u B  %-8s %8.1f MiB/s %8.3f sender cpu ns/byte  %6llu reports "
+         "%6llu copied %s\n",
+         size, zerocopy ? "zerocopy" : "copy",
+         received / 1048576.0 / (elapsed / 1e9), (double)cpu / received,
+         (unsigned long long)stats.zerocopy_reports,
+         (unsigned long long)stats.zerocopy_copied,
+         received == g_total ? "" : "(short)");
+
+  tcp_context_destroy(ctx);
+}
+
+int main(int argc, char* argv[]) {
+  static const uint32_t sizes[] = {4096, 16384, 65536, 262144, 1048576};
+
+  if (argc > 1) {
+    g_total = strtoull(argv[1], NULL, 10) << 20;
+  }
+
+  for (int i = 0; i < BUFFERS; ++i) {
+    g_bufs[i] = (char*)malloc(sizes[4]);
+    memset(g_bufs[i], 'a' + i, sizes[4]);
+  }
+
+  printf("sending %llu MiB per run over loopback, the kernel reports "
+         "loopback zero-copy sends as copied\n",
+         (unsigned long long)(g_total >> 20));
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    run(sizes[s], 0);
+    run(sizes[s], 1);
+  }
+
+  for (int i = 0; i < BUFFERS; ++i) {
+    free(g_bufs[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef LIB_CAPTURE_H_
+#define LIB_CAPTURE_H_
+
+#include <stdint.h>
+
+// compact binary log of the events a tcp_context delivers to its callback:
+//   header  "SOCEVCAP", u32 version, u32 reserved, u64 realtime start ns
+//   record  u8 event_type, varint ns since the previous record,
+//           varint connection id (1-based, per capture), then
+//           CONNECTED:     varint port, u8 ip length, ip
+//           DATA_RECEIVED: varint length, payload
+#define CAPTURE_MAGIC "SOCEVCAP"
+#define CAPTURE_VERSION 1
+
+void* capture_create(const char* path);
+// flushes buffered records and closes the file
+void capture_destroy(void* capture);
+// ids handed out by this capture start after the ones of earlier captures,
+// a client carrying an older id gets a fresh one and a synthetic connect
+uint32_t capture_get_base_id(void* capture);
+uint32_t capture_connect(void* capture, const char* ip, uint16_t port);
+int capture_record(void* capture, uint8_t type, uint32_t id, const void* in,
+                   uint32_t len);
+
+#endif  // LIB_CAPTURE_H_
@@ -2,6 +2,7 @@
 #define LIB_CLIENT_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 
 void* client_create(int efd, int fd, const char* ip, uint16_t port);
 void client_destroy(void* client);
@@ -11,8 +12,71 @@ int client_get_timerfd(void* client);
 uint16_t client_get_port(void* client);
 void client_set_timer(void* client, const uint64_t timeout_us);
 void client_enable_timer(void* client, int en);
+// a library deadline next to the user timer, it bounds handshakes and
+// graceful closes; 0 disarms it
+int client_get_deadline_fd(void* client);
+int client_set_deadline(void* client, const uint64_t timeout_us);
 void client_callback_on_writable(void* client);
 void client_clear_callback_on_writable(void* client);
+// owning tcp_context and a free slot for per-connection application state
+void* client_get_context(void* client);
+void client_set_context(void* client, void* ctx);
+void* client_get_user_data(void* client);
+void client_set_user_data(void* client, void* user_data);
+void client_set_connecting(void* client, int connecting);
+int client_is_connecting(void* client);
+void* client_get_proxy(void* client);
+void client_set_proxy(void* client, void* proxy);
+// raw epoll interest, for clients whose i/o the library drives itself
+void client_set_interest(void* client, int in, int out);
+// polls for writability while queued output, the callback or a tls read
+// that stopped on a full socket wait for it
+void client_update_interest(void* client);
+int client_wants_writable(void* client);
+void client_enable_read(void* client, int en);
 int client_write(void* client, const void* data, unsigned int len);
+// sendfile semantics, advances *offset by the bytes sent and fails with
+// EAGAIN while queued output is pending; sendfile raises SIGPIPE on a reset
+// connection, the application must ignore it
+ssize_t client_sendfile(void* client, int in_fd, off_t* offset, size_t len);
+
+// graceful close, queued output is flushed before the client is removed
+void client_close(void* client);
+int client_is_closing(void* client);
+
+// queued output made of refcounted payloads shared between clients
+int client_enqueue(void* client, void* payload);
+int client_flush(void* client);
+void client_discard_output(void* client);
+int client_has_pending_output(void* client);
+uint64_t client_get_queued_bytes(void* client);
+int client_is_slow(void* client);
+void client_set_slow(void* client, int slow);
+
+// the client owns its tls session and releases it when destroyed
+void* client_get_tls(void* client);
+void client_set_tls(void* client, void* tls);
+// same for a shared memory link, once set writes go to its ring
+void* client_get_shm(void* client);
+void client_set_shm(void* client, void* shm);
+
+// sends without copying when len reaches the threshold: data stays pinned
+// and must not change until EVT_CLIENT_SEND_COMPLETE hands it back, returns
+// 0 in that case, 1 if it was copied and can be reused right away
+int client_write_zerocopy(void* client, const void* data, uint32_t len);
+void client_set_zerocopy_threshold(void* client, uint32_t threshold);
+// drains the error queue, returns the number of completion reports and
+// counts those the kernel had to satisfy with a copy
+int client_read_zerocopy_completions(void* client, uint32_t* copied);
+int client_has_zerocopy_pending(void* client);
+// pops the oldest completed buffer, force releases it regardless
+int client_pop_zerocopy_done(void* client, int force, const void** data,
+                             uint32_t* len);
+
+uint32_t client_get_capture_id(void* client);
+void client_set_capture_id(void* client, uint32_t id);
+
+void* client_get_groups(void* client);
+void client_set_groups(void* client, void* groups);
 
 #endif  // LIB_CLIENT_H_
@@ -3,7 +3,12 @@
 
 #include <stdint.h>
 
-typedef enum { FD_REGULAR = 0, FD_TIMER, __MAX_FD_CNT } fd_type_t;
+typedef enum {
+  FD_REGULAR = 0,
+  FD_TIMER,
+  FD_DEADLINE,
+  __MAX_FD_CNT
+} fd_type_t;
 
 typedef struct {
   fd_type_t type;
@@ -6,5 +6,8 @@
 int epoll_ctl_add(int epfd, int fd, uint32_t events);
 int epoll_ctl_del(int epfd, int fd);
 int epoll_ctl_change(int epfd, int fd, uint32_t events);
+// registers fd with an arbitrary tag instead of the fd itself as event data
+int epoll_ctl_add_tagged(int epfd, int fd, uint32_t events, uint64_t tag);
+int epoll_ctl_change_tagged(int epfd, int fd, uint32_t events, uint64_t tag);
 
 #endif  // LIB_EPOLL_HELPER_H_
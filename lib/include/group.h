@@ -0,0 +1,21 @@
+#ifndef LIB_GROUP_H_
+#define LIB_GROUP_H_
+
+#include <stdint.h>
+
+void* group_create(const char* name);
+void group_destroy(void* group);
+const char* group_get_name(void* group);
+uint32_t group_get_count(void* group);
+int group_is_dirty(void* group);
+void group_set_dirty(void* group, int dirty);
+int group_add_client(void* group, void* client);
+int group_del_client(void* group, void* client);
+// drops every membership of the client, called when the client is destroyed
+void group_leave_all(void* client);
+// the callback may remove any client from the group, or remove clients
+// altogether; memberships dropped meanwhile are unlinked once the walk ends
+void group_foreach(void* group, void (*fn)(void* client, void* arg),
+                   void* arg);
+
+#endif  // LIB_GROUP_H_
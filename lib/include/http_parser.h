@@ -0,0 +1,53 @@
+#ifndef LIB_HTTP_PARSER_H_
+#define LIB_HTTP_PARSER_H_
+
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 32
+
+// slices point into the caller's buffer, nothing is copied
+typedef struct {
+  const char* ptr;
+  uint32_t len;
+} http_slice;
+
+typedef struct {
+  http_slice name;
+  http_slice value;
+} http_header;
+
+typedef struct {
+  http_slice method;
+  http_slice path;
+  int minor_version;
+  http_header headers[HTTP_MAX_HEADERS];
+  uint32_t header_cnt;
+  uint64_t content_length;
+  int chunked;
+  int keep_alive;
+} http_request_head;
+
+typedef struct {
+  int state;
+  uint64_t chunk_left;
+} http_chunked_decoder;
+
+// returns the offset just past the blank line ending the head, 0 if it is
+// not complete yet; scanning resumes at *scan_pos so bytes are looked at once
+uint32_t http_find_head_end(const char* buf, uint32_t len, uint32_t* scan_pos);
+
+// parses a complete head of head_len bytes, returns -1 when malformed
+int http_parse_request_head(const char* buf, uint32_t head_len,
+                            http_request_head* out);
+
+// finds a header by case-insensitive name, returns an empty slice if absent
+http_slice http_find_header(const http_request_head* head, const char* name);
+
+// decodes a chunked body in place: consumes from buf[*src, len) and appends
+// the payload at buf[*dst], returns 1 when the last chunk was seen, 0 when
+// more input is needed and -1 on malformed input
+void http_chunked_init(http_chunked_decoder* dec);
+int http_chunked_decode(http_chunked_decoder* dec, char* buf, uint32_t len,
+                        uint32_t* src, uint32_t* dst);
+
+#endif  // LIB_HTTP_PARSER_H_
@@ -0,0 +1,45 @@
+#ifndef LIB_HTTP_SERVER_H_
+#define LIB_HTTP_SERVER_H_
+
+#include <stdint.h>
+
+#include "http_parser.h"
+
+typedef struct {
+  uint16_t port;
+  uint64_t max_client_count;
+  uint32_t max_request_size;   // head plus body, 0 selects 1 MiB
+  uint32_t max_pipelined;      // requests in flight per connection, 0 selects 16
+  uint64_t idle_timeout_us;    // keep-alive connection without request, 0 off
+  uint64_t header_timeout_us;  // time to receive a whole request, 0 off
+  // every request must eventually be answered with http_respond or a
+  // chunked response, possibly after the callback returned
+  void (*on_request)(void* req);
+  void* user;
+  uint32_t options;  // tcp_context_option
+  uint16_t cpu;
+} http_server_params;
+
+void* http_server_create(http_server_params params);
+void http_server_destroy(void* server);
+int http_server_service(void* server, int timeout_ms);
+void* http_server_get_context(void* server);
+void* http_server_get_user(void* server);
+
+// head and body point into the connection buffer and are only valid during
+// on_request, the request handle itself stays valid until it is answered
+void* http_request_get_server(void* req);
+void* http_request_get_client(void* req);
+const http_request_head* http_request_get_head(void* req);
+const char* http_request_get_body(void* req);
+uint32_t http_request_get_body_len(void* req);
+
+// headers are extra "Name: value\r\n" lines or NULL, responses leave in
+// request order whatever order they are produced in
+int http_respond(void* req, int status, const char* headers, const void* body,
+                 uint32_t len);
+int http_respond_chunked_begin(void* req, int status, const char* headers);
+int http_respond_chunk(void* req, const void* data, uint32_t len);
+int http_respond_chunked_end(void* req);
+
+#endif  // LIB_HTTP_SERVER_H_
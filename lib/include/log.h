@@ -0,0 +1,68 @@
+#ifndef LIB_LOG_H_
+#define LIB_LOG_H_
+
+#include <errno.h>
+#include <stdint.h>
+
+typedef enum {
+  LOG_LEVEL_DEBUG = 0,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_OFF
+} log_level;
+
+#define LOG_MAX_ARGS 6
+
+// per call site state for rate limiting
+typedef struct {
+  uint64_t window;
+  uint32_t count;
+  uint32_t suppressed;
+} log_site_t;
+
+typedef void (*log_sink)(int level, const char* msg, void* arg);
+
+// records are formatted off the hot path, so arguments must be integers;
+// a non-zero err is appended as ": <strerror(err)>"
+void log_write(log_site_t* site, int level, int err, const char* fmt,
+               uint32_t nargs, const uint64_t* args);
+int log_get_level(void);
+void log_set_level(int level);
+// records per second and call site, 0 disables rate limiting
+void log_set_rate_limit(uint32_t per_sec);
+// NULL restores the default stderr sink
+void log_set_sink(log_sink sink, void* arg);
+
+// formats and hands every pending record to the sink
+void log_flush(void);
+// flushes on the calling thread unless a flush thread runs; tcp_context
+// polls once per service call, so by default records are formatted and the
+// sink is called on the loop thread
+void log_poll(void);
+// the default stays synchronous; a flush thread takes formatting and the
+// sink (stderr included) off the loops, records then appear up to
+// interval_ms late
+int log_start_thread(uint32_t interval_ms);
+void log_stop_thread(void);
+
+#define SOCEV_LOG(level, err, fmt, ...)                                  \
+  do {                                                                   \
+    if ((level) >= log_get_level()) {                                    \
+      static log_site_t log_site_;                                       \
+      const int log_err_ = (err);                                        \
+      const uint64_t log_args_[] = {0, ##__VA_ARGS__};                   \
+      log_write(&log_site_, (level), log_err_, (fmt),                    \
+                sizeof(log_args_) / sizeof(log_args_[0]) - 1,            \
+                log_args_ + 1);                                          \
+    }                                                                    \
+  } while (0)
+
+#define LOG_DEBUG(fmt, ...) SOCEV_LOG(LOG_LEVEL_DEBUG, 0, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) SOCEV_LOG(LOG_LEVEL_INFO, 0, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) SOCEV_LOG(LOG_LEVEL_WARN, 0, fmt, ##__VA_ARGS__)
+#define LOG_ERR(fmt, ...) SOCEV_LOG(LOG_LEVEL_ERROR, 0, fmt, ##__VA_ARGS__)
+#define LOG_ERRNO(fmt, ...) \
+  SOCEV_LOG(LOG_LEVEL_ERROR, errno, fmt, ##__VA_ARGS__)
+
+#endif  // LIB_LOG_H_
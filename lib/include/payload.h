@@ -0,0 +1,12 @@
+#ifndef LIB_PAYLOAD_H_
+#define LIB_PAYLOAD_H_
+
+#include <stdint.h>
+
+void* payload_create(const void* data, uint32_t len);
+void payload_ref(void* payload);
+void payload_unref(void* payload);
+const char* payload_get_data(void* payload);
+uint32_t payload_get_len(void* payload);
+
+#endif  // LIB_PAYLOAD_H_
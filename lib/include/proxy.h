@@ -0,0 +1,11 @@
+#ifndef LIB_PROXY_H_
+#define LIB_PROXY_H_
+
+void* proxy_create(void* a, void* b);
+void proxy_destroy(void* proxy);
+void* proxy_get_peer(void* proxy, void* client);
+// moves bytes both ways as far as readiness allows, returns 1 once both
+// directions reached end of stream, -1 on error and 0 otherwise
+int proxy_pump(void* proxy);
+
+#endif  // LIB_PROXY_H_
@@ -0,0 +1,33 @@
+#ifndef LIB_REPLAY_H_
+#define LIB_REPLAY_H_
+
+#include <stdint.h>
+
+#include "tcp_context.h"
+
+typedef enum {
+  REPLAY_FAST = 0,   // events back to back
+  REPLAY_REALTIME,   // events at their recorded offsets
+} replay_mode;
+
+typedef struct {
+  uint64_t events;       // callbacks invoked
+  uint64_t data_events;  // of those, EVT_CLIENT_DATA_RECEIVED
+  uint64_t bytes;        // payload handed to the callback
+  uint64_t connections;
+  uint64_t elapsed_ns;   // wall time of the whole replay
+  uint64_t handler_ns;   // time spent inside the callback
+  uint64_t latency_p50_ns;
+  uint64_t latency_p99_ns;
+  uint64_t latency_max_ns;
+} replay_stats;
+
+// feeds a capture written by tcp_context_capture_start to callback without
+// any network i/o; clients are real handles whose output is discarded and
+// whose context is NULL, so client_write and user data work as usual
+int replay_run(const char* path,
+               void (*callback)(const event_type ev, void* c_info,
+                                const void* in, const uint32_t len),
+               replay_mode mode, replay_stats* out);
+
+#endif  // LIB_REPLAY_H_
@@ -0,0 +1,32 @@
+#ifndef LIB_SHM_LINK_H_
+#define LIB_SHM_LINK_H_
+
+#include <stdint.h>
+
+// a pair of single-producer single-consumer byte rings in one memfd shared
+// by two processes, each side sleeps on its own eventfd doorbell
+#define SHM_LINK_FDS 3
+
+// creates the mapping, fds receives the memfd and the two doorbells in the
+// order shm_link_attach expects them on the other side
+void* shm_link_create(uint32_t ring_size, int fds[SHM_LINK_FDS]);
+// takes ownership of the fds
+void* shm_link_attach(const int fds[SHM_LINK_FDS]);
+void shm_link_destroy(void* link);
+// becomes readable when the peer rings this side
+int shm_link_get_doorbell(void* link);
+void shm_link_ack_doorbell(void* link);
+
+// copies as much as fits, returns the bytes written
+uint32_t shm_link_write(void* link, const void* data, uint32_t len);
+// contiguous readable bytes at *data, valid until shm_link_consume
+uint32_t shm_link_peek(void* link, const void** data);
+void shm_link_consume(void* link, uint32_t len);
+int shm_link_has_space(void* link);
+
+// ask the peer for a doorbell on new data or on freed space, returns 1 if
+// there is already something to do and the caller must not sleep
+int shm_link_arm_read(void* link);
+int shm_link_arm_write(void* link);
+
+#endif  // LIB_SHM_LINK_H_
@@ -0,0 +1,17 @@
+#ifndef LIB_TASK_QUEUE_H_
+#define LIB_TASK_QUEUE_H_
+
+#include <stdint.h>
+
+typedef void (*task_fn)(void* arg);
+
+void* task_queue_create(uint32_t capacity);
+// pending tasks are dropped without running
+void task_queue_destroy(void* queue);
+uint32_t task_queue_count(void* queue);
+// grows the queue when it is full
+int task_queue_push(void* queue, task_fn fn, void* arg);
+// pops the oldest task, returns -1 if the queue is empty
+int task_queue_pop(void* queue, task_fn* fn, void** arg);
+
+#endif  // LIB_TASK_QUEUE_H_
@@ -2,6 +2,7 @@
 #define LIB_TCP_CONTEXT_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 
 typedef enum {
   EVT_CLIENT_CONNECTED = 0,
@@ -9,19 +10,159 @@ typedef enum {
   EVT_CLIENT_WRITABLE,
   EVT_CLIENT_DATA_RECEIVED,
   EVT_CLIENT_TIMER_EXPIRED,
+  EVT_CLIENT_SLOW,
+  // a client_write_zerocopy buffer is released, `in` and `len` describe it
+  EVT_CLIENT_SEND_COMPLETE,
   __EVT_MAX_COUNT
 } event_type;
 
+typedef enum {
+  // pin the thread calling tcp_context_create to params.cpu, the context
+  // must then be serviced from that same thread
+  OPT_PIN_CPU = 1 << 0,
+  // join a SO_REUSEPORT group on params.port and prefer the flows whose
+  // packets the kernel processes on params.cpu (SO_INCOMING_CPU); the
+  // kernel honours SO_INCOMING_CPU inside a reuseport group since 6.2,
+  // older ones hash flows across the group unless a cBPF program is
+  // attached with SO_ATTACH_REUSEPORT_CBPF, flows_local tells how it went
+  OPT_STEER_INCOMING_CPU = 1 << 1,
+  // close clients whose queued output exceeds max_queued_bytes instead of
+  // only skipping them in broadcasts
+  OPT_DROP_SLOW_CLIENTS = 1 << 2,
+  // keep tls record processing in userspace even where the kernel could
+  // take over after the handshake
+  OPT_TLS_NO_KTLS = 1 << 3,
+} tcp_context_option;
+
+typedef enum {
+  WATCH_READ = 1 << 0,
+  WATCH_WRITE = 1 << 1,
+  WATCH_ERROR = 1 << 2,  // reported only, hangup or error on the fd
+} watch_flags;
+
+// watcher callbacks run on the loop thread, the watcher handle is the one
+// returned when it was registered
+typedef void (*fd_watch_callback)(void* watcher, int fd, uint32_t events,
+                                  void* arg);
+typedef void (*signal_watch_callback)(void* watcher, int signo, void* arg);
+// status is a waitpid status, the watcher is released when this returns
+typedef void (*child_watch_callback)(void* watcher, pid_t pid, int status,
+                                     void* arg);
+
 typedef struct {
   uint16_t port;
   uint64_t max_client_count;
   void (*callback)(const event_type ev, void* c_info, const void* in,
                    const uint32_t len);
+  uint32_t options;
+  uint16_t cpu;
+  uint64_t max_queued_bytes;  // 0 means no limit
+  void* user;                 // returned by tcp_context_get_user
+  // time tcp_context_service may spend on deferred and idle tasks after its
+  // i/o callbacks, the rest rolls over to the next call, 0 means no limit
+  uint64_t task_budget_us;
+  // PEM files, accepted connections speak tls when a certificate is given
+  // and are reported as connected once their handshake completed, within
+  // 10 s or they are dropped; OpenSSL and ktls write to the socket without
+  // MSG_NOSIGNAL, so the application must ignore SIGPIPE
+  const char* tls_cert_file;
+  const char* tls_key_file;
+  // client_write_zerocopy copies buffers below this size, 0 keeps 64 KiB
+  uint32_t zerocopy_threshold;
+  // unix socket where processes on this host set up shared memory links,
+  // NULL accepts tcp only; a peer holds a client slot while it sets its
+  // link up and is dropped if that takes longer than a second
+  const char* shm_path;
+  // bytes per direction of the links this context creates, a power of two,
+  // 0 keeps 1 MiB
+  uint32_t shm_ring_size;
+  // a link that carried data keeps being polled by the loop this long, its
+  // peer skips the doorbell meanwhile; 0 sleeps on the doorbell right away
+  uint32_t shm_poll_us;
 } tcp_context_params;
 
+typedef struct {
+  int cpu;                // cpu servicing the loop, -1 if unknown
+  uint64_t flows;         // accepted connections
+  uint64_t flows_local;   // connections whose packets arrive on `cpu`
+  uint64_t flows_remote;  // connections whose packets arrive elsewhere
+  uint64_t tls_handshakes;  // completed tls handshakes
+  uint64_t tls_ktls_send;   // of those, encrypting in the kernel
+  uint64_t tls_ktls_recv;   // of those, decrypting in the kernel
+  uint64_t zerocopy_reports;  // MSG_ZEROCOPY completion reports
+  uint64_t zerocopy_copied;   // of those, sends the kernel copied anyway
+  uint64_t shm_links;      // shared memory links set up
+  uint64_t shm_doorbells;  // wakeups rung by shared memory peers
+} tcp_context_stats;
+
 void* tcp_context_create(tcp_context_params params);
 void tcp_context_destroy(void* tcp_ctx);
 
+// ends with log_poll: unless log_start_thread runs a flush thread, log
+// records of the pass are formatted and written to the sink (stderr by
+// default) synchronously on the calling thread
 int tcp_context_service(void* tcp_ctx, int timeout_ms);
+void* tcp_context_get_user(void* tcp_ctx);
+int tcp_context_get_stats(void* tcp_ctx, tcp_context_stats* out);
+
+// non-blocking outbound connection, EVT_CLIENT_CONNECTED or
+// EVT_CLIENT_DISCONNECTED reports the outcome
+void* tcp_context_connect(void* tcp_ctx, const char* ip, uint16_t port);
+// shared memory link with the context listening on a unix socket at path,
+// the client then behaves like a tcp one and EVT_CLIENT_CONNECTED follows
+// from the next service call
+void* tcp_context_connect_shm(void* tcp_ctx, const char* path);
+// links two clients and moves bytes between them inside the kernel, the
+// callback then only sees their connect and disconnect events; tls clients
+// qualify only when the kernel handles both directions, shm clients never;
+// splice raises SIGPIPE on a reset connection, the application must ignore it
+int tcp_context_proxy(void* tcp_ctx, void* a, void* b);
+
+// named groups of clients, a client leaves all its groups when it is removed
+int tcp_context_group_join(void* tcp_ctx, const char* name, void* client);
+int tcp_context_group_leave(void* tcp_ctx, const char* name, void* client);
+uint32_t tcp_context_group_count(void* tcp_ctx, const char* name);
+// queues one shared copy of data to every member, returns the number of
+// members it was queued to
+int tcp_context_broadcast(void* tcp_ctx, const char* name, const void* data,
+                          uint32_t len);
+
+// runs fn(arg) once on the loop thread after the i/o callbacks of the
+// current or next service call, in the order tasks were deferred
+int tcp_context_defer(void* tcp_ctx, void (*fn)(void* arg), void* arg);
+// runs fn(arg) once during a service call whose epoll_wait found no events
+// and whose deferred tasks are all done
+int tcp_context_idle(void* tcp_ctx, void (*fn)(void* arg), void* arg);
+uint32_t tcp_context_pending_tasks(void* tcp_ctx);
+
+// watches an fd the caller keeps owning for WATCH_READ and/or WATCH_WRITE,
+// it must be unwatched before it is closed
+void* tcp_context_watch_fd(void* tcp_ctx, int fd, uint32_t interest,
+                           fd_watch_callback cb, void* arg);
+int tcp_context_watch_fd_modify(void* watcher, uint32_t interest);
+// blocks signo in the calling thread and reads it from a signalfd, other
+// threads of the process must block it as well
+void* tcp_context_watch_signal(void* tcp_ctx, int signo,
+                               signal_watch_callback cb, void* arg);
+// reports the exit of a child process through a pidfd and reaps it
+void* tcp_context_watch_child(void* tcp_ctx, pid_t pid,
+                              child_watch_callback cb, void* arg);
+// stops a watcher, also safe from inside its own callback
+void tcp_context_unwatch(void* tcp_ctx, void* watcher);
+
+// writes every event handed to the callback, with its payload, to a
+// compact binary log that replay_run feeds back offline; must be called
+// from the servicing thread
+int tcp_context_capture_start(void* tcp_ctx, const char* path);
+void tcp_context_capture_stop(void* tcp_ctx);
+
+// records every phase of tcp_context_service into a ring of `capacity`
+// entries, must be called from the servicing thread
+int tcp_context_trace_enable(void* tcp_ctx, uint32_t capacity);
+void tcp_context_trace_disable(void* tcp_ctx);
+// writes the ring as chrome trace / perfetto json
+int tcp_context_trace_dump(void* tcp_ctx, const char* path);
+// async-signal-safe, the dump happens at the end of the next service call
+void tcp_context_trace_request_dump(void* tcp_ctx, const char* path);
 
 #endif  // LIB_TCP_CONTEXT_H_
@@ -0,0 +1,36 @@
+#ifndef LIB_TLS_H_
+#define LIB_TLS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum { TLS_DONE = 0, TLS_WANT_READ, TLS_WANT_WRITE } tls_state;
+
+// server side configuration shared by all connections of a tcp_context,
+// ktls asks OpenSSL to hand the session keys to the kernel after handshakes
+void* tls_config_create(const char* cert_file, const char* key_file,
+                        int ktls);
+void tls_config_destroy(void* config);
+
+void* tls_create(void* config, int fd);
+// sends close_notify if the session was established
+void tls_destroy(void* tls);
+// returns a tls_state, or -1 once the handshake failed
+int tls_handshake(void* tls);
+int tls_is_established(void* tls);
+// record encryption and decryption run in the kernel for that direction
+int tls_ktls_send(void* tls);
+int tls_ktls_recv(void* tls);
+// like recv and send: -1 with errno EAGAIN when the socket is not ready, 0
+// from tls_read at end of stream; data buffered inside the library is
+// reported by tls_pending
+ssize_t tls_read(void* tls, void* buf, size_t len);
+ssize_t tls_write(void* tls, const void* buf, size_t len);
+int tls_pending(void* tls);
+// the last tls_read stopped because the socket was not writable, it is to
+// be retried once it is
+int tls_read_wants_write(void* tls);
+// zero-copy file send, only when tls_ktls_send is set
+ssize_t tls_sendfile(void* tls, int in_fd, off_t offset, size_t len);
+
+#endif  // LIB_TLS_H_
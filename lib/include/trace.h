@@ -0,0 +1,39 @@
+#ifndef LIB_TRACE_H_
+#define LIB_TRACE_H_
+
+#include <stdint.h>
+
+typedef enum {
+  TRACE_EPOLL_WAIT = 0,
+  TRACE_ACCEPT,
+  TRACE_RECV,
+  TRACE_CALLBACK,
+  TRACE_EPOLL_CTL,
+  TRACE_TIMER,
+  TRACE_TASK,
+  TRACE_WATCHER,
+  __TRACE_MAX_COUNT
+} trace_event_type;
+
+typedef struct {
+  uint64_t ts_ns;     // start of the phase, CLOCK_MONOTONIC
+  uint32_t dur_ns;    // duration of the phase
+  int32_t fd;         // fd the phase worked on, -1 if none
+  uint16_t type;      // trace_event_type
+  uint16_t arg;       // phase specific, event_type for TRACE_CALLBACK,
+                      // 1 for idle TRACE_TASK
+} trace_record_t;
+
+void* trace_create(uint32_t capacity);
+void trace_destroy(void* trace);
+uint32_t trace_get_capacity(void* trace);
+uint64_t trace_get_count(void* trace);
+void trace_record(void* trace, uint16_t type, int fd, uint64_t start_ns,
+                  uint16_t arg);
+int trace_dump_chrome(void* trace, const char* path);
+
+uint64_t trace_now(void);
+void trace_set_current(void* trace);
+void* trace_get_current(void);
+
+#endif  // LIB_TRACE_H_
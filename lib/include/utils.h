@@ -1,12 +1,26 @@
 #ifndef LIB_UTILS_H_
 #define LIB_UTILS_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct timespec;
 
-int create_listener_socket(uint16_t port);
+int create_listener_socket(uint16_t port, int reuseport);
+// replaces a stale socket file left at path
+int create_unix_listener_socket(const char* path);
+// one byte carrying n descriptors over a unix socket, recv_fds returns 0 at
+// end of stream
+int send_fds(int fd, const int* fds, int n);
+int recv_fds(int fd, int* fds, int n);
 int set_socket_nonblocking(int fd);
+int set_socket_nodelay(int fd);
+int set_socket_incoming_cpu(int fd, int cpu);
+int get_socket_incoming_cpu(int fd);
+
+int pin_thread_to_cpu(int cpu);
+void* alloc_local(size_t size);
+void free_local(void* ptr, size_t size);
 
 struct timespec to_timespec(const int64_t interval_us);
 int arm_timer(int timer_fd, const int64_t interval_us);
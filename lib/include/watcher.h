@@ -0,0 +1,28 @@
+#ifndef LIB_WATCHER_H_
+#define LIB_WATCHER_H_
+
+#include <stdint.h>
+
+#include "tcp_context.h"
+
+// set in the epoll data of watchers, clients and the listener carry their
+// bare fd, so the loop tells them apart without a lookup
+#define WATCHER_TAG (1ull << 63)
+
+void* watcher_create_fd(int efd, int fd, uint32_t interest,
+                        fd_watch_callback cb, void* arg);
+void* watcher_create_signal(int efd, int signo, signal_watch_callback cb,
+                            void* arg);
+void* watcher_create_child(int efd, pid_t pid, child_watch_callback cb,
+                           void* arg);
+// stops and frees the watcher, no epoll event may refer to it any more
+void watcher_destroy(void* watcher);
+int watcher_set_interest(void* watcher, uint32_t interest);
+// deregisters the watcher and closes the fds it owns, the memory stays
+// valid until watcher_destroy so that pending events can be skipped
+void watcher_stop(void* watcher);
+int watcher_is_stopped(void* watcher);
+int watcher_get_fd(void* watcher);
+void watcher_dispatch(void* watcher, uint32_t events);
+
+#endif  // LIB_WATCHER_H_
@@ -0,0 +1,203 @@
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tcp_context.h"
+
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+// type, three varints and the ip, well above any record header
+#define MAX_RECORD_HEADER 64
+
+// ids are unique for the lifetime of the process so that a stale id from
+// an earlier capture is never mistaken for a current one, contexts on other
+// threads draw from the same counter
+static _Atomic uint32_t g_next_id = 1;
+
+typedef struct {
+  int fd;
+  char* buf;
+  uint32_t used;
+  uint32_t base_id;
+  uint64_t last_ns;
+  int failed;
+} capture_t;
+
+static inline uint64_t now_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint32_t put_varint(char* p, uint64_t v) {
+  uint32_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (char)v;
+  return n;
+}
+
+static int write_all(int fd, const char* p, size_t len) {
+  while (len) {
+    const ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int flush_buffer(capture_t* c) {
+  if (c->failed) {
+    return -1;
+  }
+
+  if (write_all(c->fd, c->buf, c->used) == -1) {
+    // a truncated capture is still replayable up to the failure
+    LOG_ERRNO("capture write err");
+    c->failed = 1;
+    return -1;
+  }
+
+  c->used = 0;
+  return 0;
+}
+
+static int append(capture_t* c, const void* data, uint32_t len) {
+  if (CAPTURE_BUFFER_SIZE - c->used < len) {
+    if (flush_buffer(c) == -1) {
+      return -1;
+    }
+    // payloads larger than the buffer bypass it
+    if (len > CAPTURE_BUFFER_SIZE) {
+      return write_all(c->fd, (const char*)data, len);
+    }
+  }
+
+  memcpy(c->buf + c->used, data, len);
+  c->used += len;
+  return 0;
+}
+
+void* capture_create(const char* path) {
+  capture_t* c = NULL;
+
+  if (!path) {
+    LOG_ERR("capture_create err: invalid path");
+    goto create_err;
+  }
+
+  c = (capture_t*)calloc(1, sizeof(capture_t));
+  if (!c) {
+    LOG_ERR("cannot create capture");
+    goto create_err;
+  }
+
+  c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (c->fd == -1) {
+    LOG_ERRNO("capture_create err");
+    goto create_err;
+  }
+
+  c->buf = (char*)malloc(CAPTURE_BUFFER_SIZE);
+  if (!c->buf) {
+    LOG_ERR("cannot create capture buffer");
+    goto create_err;
+  }
+
+  c->base_id = atomic_load_explicit(&g_next_id, memory_order_relaxed);
+  c->last_ns = now_ns(CLOCK_MONOTONIC);
+
+  char header[24];
+  const uint32_t version = CAPTURE_VERSION;
+  const uint32_t reserved = 0;
+  const uint64_t start = now_ns(CLOCK_REALTIME);
+  memcpy(header, CAPTURE_MAGIC, 8);
+  memcpy(header + 8, &version, 4);
+  memcpy(header + 12, &reserved, 4);
+  memcpy(header + 16, &start, 8);
+  append(c, header, sizeof(header));
+
+  return c;
+
+create_err:
+  capture_destroy(c);
+  return NULL;
+}
+
+void capture_destroy(void* capture) {
+  if (capture) {
+    capture_t* c = (capture_t*)capture;
+    if (c->fd != -1) {
+      if (c->buf) {
+        flush_buffer(c);
+      }
+      close(c->fd);
+    }
+    free(c->buf);
+    free(c);
+  }
+}
+
+uint32_t capture_get_base_id(void* capture) {
+  capture_t* c = (capture_t*)capture;
+  return c ? c->base_id : 0;
+}
+
+static uint32_t put_header(capture_t* c, char* p, uint8_t type, uint32_t id) {
+  const uint64_t now = now_ns(CLOCK_MONOTONIC);
+  uint32_t n = 0;
+
+  p[n++] = (char)type;
+  n += put_varint(p + n, now - c->last_ns);
+  n += put_varint(p + n, id - c->base_id + 1);
+  c->last_ns = now;
+  return n;
+}
+
+uint32_t capture_connect(void* capture, const char* ip, uint16_t port) {
+  capture_t* c = (capture_t*)capture;
+  char rec[MAX_RECORD_HEADER];
+  const uint32_t id =
+      atomic_fetch_add_explicit(&g_next_id, 1, memory_order_relaxed);
+  const size_t ip_len = ip ? strnlen(ip, 15) : 0;
+
+  uint32_t n = put_header(c, rec, EVT_CLIENT_CONNECTED, id);
+  n += put_varint(rec + n, port);
+  rec[n++] = (char)ip_len;
+  memcpy(rec + n, ip, ip_len);
+  n += ip_len;
+
+  append(c, rec, n);
+  return id;
+}
+
+int capture_record(void* capture, uint8_t type, uint32_t id, const void* in,
+                   uint32_t len) {
+  capture_t* c = (capture_t*)capture;
+  char rec[MAX_RECORD_HEADER];
+
+  uint32_t n = put_header(c, rec, type, id);
+  if (type != EVT_CLIENT_DATA_RECEIVED) {
+    return append(c, rec, n);
+  }
+
+  n += put_varint(rec + n, len);
+  if (append(c, rec, n) == -1) {
+    return -1;
+  }
+  return append(c, in, len);
+}
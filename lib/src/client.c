@@ -1,47 +1,125 @@
 #include "client.h"
 
 #include <errno.h>
+#include <linux/errqueue.h>
 #include <malloc.h>
 #include <stdio.h>
 #include <string.h>
+#include <netinet/in.h>
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "epoll_helper.h"
+#include "group.h"
+#include "log.h"
+#include "payload.h"
+#include "shm_link.h"
+#include "tls.h"
 #include "utils.h"
 
+#define MAX_FLUSH_IOV 64
+#define DEFAULT_ZEROCOPY_THRESHOLD (64 * 1024)
+#define CLOSE_TIMEOUT_US (5 * 1000 * 1000)
+
+typedef struct {
+  void* payload;   // NULL for a zero-copy entry
+  const char* zc;  // caller's buffer, pinned until its send completed
+  uint32_t len;
+  uint32_t off;
+} send_entry_t;
+
+// a zero-copy buffer is complete once it left the send queue and the
+// kernel reported every send call that referenced it
+typedef struct {
+  const void* data;
+  uint32_t len;
+  uint32_t last_id;  // id of the last MSG_ZEROCOPY call covering it
+  int has_ids;
+} zc_buffer_t;
+
 typedef struct {
   uint16_t port;
   char ip[16];
   int efd;
   int fd;
   int timer_fd;
+  int deadline_fd;  // library deadline, -1 until one is first set
   uint32_t events;
   uint32_t timer_events;
+  int want_writable;
+  int slow;
+  int closing;
+  int connecting;
+  void* proxy;
+  void* context;
+  void* user_data;
+  void* groups;
+  void* tls;  // NULL for plain tcp
+  void* shm;  // data goes through shared rings, fd only tracks the peer
+  uint32_t capture_id;
+  // ring of queued payloads, flushed with one sendmsg per batch
+  send_entry_t* queue;
+  uint32_t queue_cap;
+  uint32_t queue_head;
+  uint32_t queue_cnt;
+  uint64_t queued_bytes;
+  // zero-copy buffers in send order, the first zc_sent ones left the queue
+  zc_buffer_t* zc_bufs;
+  uint32_t zc_cap;
+  uint32_t zc_head;
+  uint32_t zc_cnt;
+  uint32_t zc_sent;
+  uint32_t zc_threshold;
+  uint32_t zc_next_id;  // the kernel numbers MSG_ZEROCOPY calls from 0
+  uint32_t zc_acked;    // every id below this one completed
+  int zc_state;         // 0 unknown, 1 SO_ZEROCOPY set, -1 unsupported
 } client_t;
 
+static void update_events(client_t* inf) {
+  // ring space is the loop's business, the socket is always writable
+  if (inf->shm) {
+    return;
+  }
+
+  uint32_t events = inf->events & ~EPOLLOUT;
+  if (inf->want_writable || inf->queue_cnt ||
+      (inf->tls && tls_read_wants_write(inf->tls))) {
+    events |= EPOLLOUT;
+  }
+
+  if (events != inf->events) {
+    inf->events = events;
+    epoll_ctl_change(inf->efd, inf->fd, inf->events);
+  }
+}
+
 void* client_create(int efd, int fd, const char* ip, uint16_t port) {
   client_t* ci = NULL;
 
   if (efd == -1 || fd == -1) {
-    fprintf(stderr, "invalid fd for client\n");
+    LOG_ERR("invalid fd for client");
     goto create_err;
   }
 
   ci = (client_t*)calloc(1, sizeof(client_t));
   if (!ci) {
-    fprintf(stderr, "cannot create client\n");
+    LOG_ERR("cannot create client");
     goto create_err;
   }
 
   ci->efd = efd;
   ci->fd = fd;
+  ci->deadline_fd = -1;
   ci->timer_fd = timerfd_create(CLOCK_REALTIME, 0);
   ci->events = EPOLLIN;
   ci->timer_events = 0;
+  ci->zc_threshold = DEFAULT_ZEROCOPY_THRESHOLD;
   if (ci->timer_fd == -1) {
-    fprintf(stderr, "cannot create timer for client: %s\n", strerror(errno));
+    LOG_ERRNO("cannot create timer for client");
     goto create_err;
   }
 
@@ -66,6 +144,8 @@ create_err:
 void client_destroy(void* client) {
   if (client) {
     client_t* client_info = (client_t*)client;
+    tls_destroy(client_info->tls);
+    shm_link_destroy(client_info->shm);
     if (client_info->fd != -1) {
       epoll_ctl_del(client_info->efd, client_info->fd);
       close(client_info->fd);
@@ -74,7 +154,15 @@ void client_destroy(void* client) {
       epoll_ctl_del(client_info->efd, client_info->timer_fd);
       close(client_info->timer_fd);
     }
+    if (client_info->deadline_fd != -1) {
+      epoll_ctl_del(client_info->efd, client_info->deadline_fd);
+      close(client_info->deadline_fd);
+    }
 
+    group_leave_all(client_info);
+    client_discard_output(client_info);
+    free(client_info->queue);
+    free(client_info->zc_bufs);
     free(client_info);
   }
 }
@@ -138,34 +226,819 @@ void client_set_timer(void* client, const uint64_t timeout_us) {
   }
 }
 
+int client_get_deadline_fd(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->deadline_fd;
+  }
+
+  return -1;
+}
+
+int client_set_deadline(void* client, const uint64_t timeout_us) {
+  if (!client) {
+    return -1;
+  }
+
+  client_t* inf = (client_t*)client;
+  if (!timeout_us) {
+    return inf->deadline_fd == -1 ? 0 : disarm_timer(inf->deadline_fd);
+  }
+
+  // most clients never need one, the timer is created on first use
+  if (inf->deadline_fd == -1) {
+    inf->deadline_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+    if (inf->deadline_fd == -1) {
+      LOG_ERRNO("cannot create deadline for client");
+      return -1;
+    }
+    if (epoll_ctl_add(inf->efd, inf->deadline_fd, EPOLLIN) == -1) {
+      close(inf->deadline_fd);
+      inf->deadline_fd = -1;
+      return -1;
+    }
+  }
+
+  return arm_timer(inf->deadline_fd, timeout_us);
+}
+
 void client_callback_on_writable(void* client) {
   if (client) {
     client_t* inf = (client_t*)client;
-    inf->events |= EPOLLOUT;
-    epoll_ctl_change(inf->efd, inf->fd, inf->events);
+    inf->want_writable = 1;
+    update_events(inf);
+  }
+}
+
+void client_update_interest(void* client) {
+  if (client) {
+    update_events((client_t*)client);
   }
 }
 
 void client_clear_callback_on_writable(void* client) {
   if (client) {
     client_t* inf = (client_t*)client;
-    inf->events &= ~EPOLLOUT;
+    inf->want_writable = 0;
+    update_events(inf);
+  }
+}
+
+void* client_get_context(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->context;
+  }
+
+  return NULL;
+}
+
+void client_set_context(void* client, void* ctx) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->context = ctx;
+  }
+}
+
+void* client_get_user_data(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->user_data;
+  }
+
+  return NULL;
+}
+
+void client_set_user_data(void* client, void* user_data) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->user_data = user_data;
+  }
+}
+
+void client_set_connecting(void* client, int connecting) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->connecting = connecting;
+    // completion of a non-blocking connect is reported as writability
+    if (connecting) {
+      inf->events = EPOLLOUT;
+    } else {
+      inf->events = EPOLLIN;
+      if (inf->want_writable || inf->queue_cnt) {
+        inf->events |= EPOLLOUT;
+      }
+    }
     epoll_ctl_change(inf->efd, inf->fd, inf->events);
   }
 }
 
+int client_is_connecting(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->connecting;
+  }
+
+  return 0;
+}
+
+void* client_get_proxy(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->proxy;
+  }
+
+  return NULL;
+}
+
+void client_set_proxy(void* client, void* proxy) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->proxy = proxy;
+  }
+}
+
+void client_set_interest(void* client, int in, int out) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    const uint32_t events = (in ? EPOLLIN : 0) | (out ? EPOLLOUT : 0);
+    if (events != inf->events) {
+      inf->events = events;
+      epoll_ctl_change(inf->efd, inf->fd, inf->events);
+    }
+  }
+}
+
+int client_wants_writable(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->want_writable;
+  }
+
+  return 0;
+}
+
+void client_enable_read(void* client, int en) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    if (en) {
+      inf->events |= EPOLLIN;
+    } else {
+      inf->events &= ~EPOLLIN;
+    }
+    epoll_ctl_change(inf->efd, inf->fd, inf->events);
+  }
+}
+
+void* client_get_groups(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->groups;
+  }
+
+  return NULL;
+}
+
+void client_set_groups(void* client, void* groups) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->groups = groups;
+  }
+}
+
+int client_is_slow(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->slow;
+  }
+
+  return 0;
+}
+
+void client_set_slow(void* client, int slow) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->slow = slow;
+  }
+}
+
+void client_close(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    if (!inf->closing) {
+      inf->closing = 1;
+      // the loop sees end of stream on the next iteration and reaps the
+      // client once its queued output is flushed, or once the timer fires
+      // if the peer stops reading
+      shutdown(inf->fd, SHUT_RD);
+      if (!(inf->events & EPOLLIN)) {
+        client_enable_read(inf, 1);
+      }
+      client_set_deadline(inf, CLOSE_TIMEOUT_US);
+    }
+  }
+}
+
+int client_is_closing(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->closing;
+  }
+
+  return 0;
+}
+
+static inline const char* entry_data(send_entry_t* e) {
+  return e->payload ? payload_get_data(e->payload) : e->zc;
+}
+
+static send_entry_t* reserve_entry(client_t* inf) {
+  if (inf->queue_cnt == inf->queue_cap) {
+    const uint32_t cap = inf->queue_cap ? inf->queue_cap * 2 : 8;
+    send_entry_t* queue = (send_entry_t*)malloc(cap * sizeof(send_entry_t));
+    if (!queue) {
+      LOG_ERR("client_enqueue err: cannot grow send queue");
+      return NULL;
+    }
+
+    // unroll the ring into the new storage
+    uint32_t i = 0;
+    for (; i < inf->queue_cnt; ++i) {
+      queue[i] = inf->queue[(inf->queue_head + i) % inf->queue_cap];
+    }
+
+    free(inf->queue);
+    inf->queue = queue;
+    inf->queue_cap = cap;
+    inf->queue_head = 0;
+  }
+
+  return &inf->queue[(inf->queue_head + inf->queue_cnt) % inf->queue_cap];
+}
+
+int client_enqueue(void* client, void* payload) {
+  if (!client || !payload) {
+    LOG_ERR("client_enqueue err: invalid argument");
+    return -1;
+  }
+
+  // nothing to send, an empty entry would only sit in the queue
+  if (!payload_get_len(payload)) {
+    return 0;
+  }
+
+  client_t* inf = (client_t*)client;
+  send_entry_t* e = reserve_entry(inf);
+  if (!e) {
+    return -1;
+  }
+
+  e->payload = payload;
+  e->zc = NULL;
+  e->len = payload_get_len(payload);
+  e->off = 0;
+  payload_ref(payload);
+
+  inf->queue_cnt++;
+  inf->queued_bytes += e->len;
+  return 0;
+}
+
+static void pop_entry(client_t* inf) {
+  send_entry_t* e = &inf->queue[inf->queue_head];
+  inf->queued_bytes -= e->len - e->off;
+  if (e->payload) {
+    payload_unref(e->payload);
+  } else {
+    // zero-copy entries leave the queue in the order they were queued
+    inf->zc_sent++;
+  }
+  inf->queue_head = (inf->queue_head + 1) % inf->queue_cap;
+  inf->queue_cnt--;
+}
+
+// write semantics over a tls session or a shared ring
+static ssize_t write_some(client_t* inf, const void* data, uint32_t len) {
+  if (inf->tls) {
+    return tls_write(inf->tls, data, len);
+  }
+
+  const uint32_t n = shm_link_write(inf->shm, data, len);
+  if (!n && len) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return n;
+}
+
+// without a socket to gather into, every entry is written on its own: as a
+// run of tls records or as a copy into the ring
+static int flush_entries(client_t* inf) {
+  while (inf->queue_cnt) {
+    send_entry_t* e = &inf->queue[inf->queue_head];
+    const uint32_t left = e->len - e->off;
+    if (!left) {
+      pop_entry(inf);
+      continue;
+    }
+
+    const ssize_t sent = write_some(inf, entry_data(e) + e->off, left);
+    if (sent == -1) {
+      if (errno == EAGAIN) {
+        break;
+      }
+      LOG_ERRNO("client_flush err");
+      return -1;
+    }
+
+    if ((uint32_t)sent < left) {
+      e->off += sent;
+      inf->queued_bytes -= sent;
+    } else {
+      pop_entry(inf);
+    }
+  }
+
+  update_events(inf);
+  return inf->queue_cnt ? 1 : 0;
+}
+
+// kernel tls encrypts whatever is written to the socket, userspace tls has
+// to go through the library
+static inline int needs_tls_write(client_t* inf) {
+  return inf->tls && !tls_ktls_send(inf->tls);
+}
+
+static inline int bypasses_socket(client_t* inf) {
+  return inf->shm || needs_tls_write(inf);
+}
+
+// one MSG_ZEROCOPY call per entry, returns 1 if the entry left the queue
+static int send_zerocopy(client_t* inf, send_entry_t* e) {
+  const uint32_t left = e->len - e->off;
+  ssize_t sent =
+      send(inf->fd, e->zc + e->off, left, MSG_NOSIGNAL | MSG_ZEROCOPY);
+  if (sent >= 0) {
+    zc_buffer_t* b = &inf->zc_bufs[(inf->zc_head + inf->zc_sent) % inf->zc_cap];
+    b->last_id = inf->zc_next_id++;
+    b->has_ids = 1;
+  } else if (errno == ENOBUFS) {
+    // out of memory for pinning pages, this part goes out as a copy
+    sent = send(inf->fd, e->zc + e->off, left, MSG_NOSIGNAL);
+  }
+
+  if (sent == -1) {
+    return -1;
+  }
+
+  if ((uint32_t)sent < left) {
+    e->off += sent;
+    inf->queued_bytes -= sent;
+    return 0;
+  }
+
+  pop_entry(inf);
+  return 1;
+}
+
+int client_flush(void* client) {
+  if (!client) {
+    return -1;
+  }
+
+  client_t* inf = (client_t*)client;
+  struct iovec iov[MAX_FLUSH_IOV];
+
+  if (bypasses_socket(inf)) {
+    return flush_entries(inf);
+  }
+
+  while (inf->queue_cnt) {
+    send_entry_t* head = &inf->queue[inf->queue_head];
+    if (head->zc) {
+      const int result = send_zerocopy(inf, head);
+      if (result == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        LOG_ERRNO("client_flush err");
+        return -1;
+      }
+      if (result == 0) {
+        break;
+      }
+      continue;
+    }
+
+    // copied payloads up to the next zero-copy entry share one sendmsg
+    uint32_t cnt = 0;
+    for (; cnt < inf->queue_cnt && cnt < MAX_FLUSH_IOV; ++cnt) {
+      send_entry_t* e = &inf->queue[(inf->queue_head + cnt) % inf->queue_cap];
+      if (e->zc) {
+        break;
+      }
+      iov[cnt].iov_base = (char*)entry_data(e) + e->off;
+      iov[cnt].iov_len = e->len - e->off;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+
+    ssize_t sent = sendmsg(inf->fd, &msg, MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      LOG_ERRNO("client_flush err");
+      return -1;
+    }
+
+    // drop whole entries and keep the offset into a partially sent one,
+    // empty entries go too or the loop would never get past them
+    while (inf->queue_cnt) {
+      send_entry_t* e = &inf->queue[inf->queue_head];
+      const uint32_t left = e->len - e->off;
+      if ((size_t)sent < left) {
+        e->off += sent;
+        inf->queued_bytes -= sent;
+        break;
+      }
+      sent -= left;
+      pop_entry(inf);
+    }
+  }
+
+  update_events(inf);
+  return inf->queue_cnt ? 1 : 0;
+}
+
+void client_discard_output(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    while (inf->queue_cnt) {
+      pop_entry(inf);
+    }
+  }
+}
+
+int client_has_pending_output(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->queue_cnt != 0;
+  }
+
+  return 0;
+}
+
+uint64_t client_get_queued_bytes(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->queued_bytes;
+  }
+
+  return 0;
+}
+
+// a record the library could not send yet must be retried with the same
+// bytes, the unsent rest is queued so that the next flush does exactly that
+static int write_entries(client_t* inf, const void* data, uint32_t len) {
+  ssize_t sent = 0;
+
+  if (!inf->queue_cnt) {
+    sent = write_some(inf, data, len);
+    if (sent == -1) {
+      if (errno != EAGAIN) {
+        LOG_ERRNO("socev_write err");
+        return -1;
+      }
+      sent = 0;
+    }
+  }
+
+  if ((uint32_t)sent < len) {
+    void* rest = payload_create((const char*)data + sent, len - sent);
+    if (!rest) {
+      return -1;
+    }
+    const int result = client_enqueue(inf, rest);
+    payload_unref(rest);
+    if (result == -1) {
+      return -1;
+    }
+    update_events(inf);
+  }
+
+  return (int)len;
+}
+
 int client_write(void* client, const void* data, unsigned int len) {
   if (!client) {
-    fprintf(stderr, "socev_write err: invalid client info\n");
+    LOG_ERR("socev_write err: invalid client info");
     return -1;
   }
 
+  // behind queued payloads the bytes queue too, a direct write would
+  // overtake them
+  client_t* inf = (client_t*)client;
+  if (bypasses_socket(inf) || inf->queue_cnt) {
+    return write_entries(inf, data, len);
+  }
+
   int fd = client_get_fd(client);
-  int result = write(fd, data, len);
+  int result = send(fd, data, len, MSG_NOSIGNAL);
 
   if (result == -1) {
-    fprintf(stderr, "socev_write err: %s\n", strerror(errno));
+    LOG_ERRNO("socev_write err");
   }
 
   return result;
 }
+
+ssize_t client_sendfile(void* client, int in_fd, off_t* offset, size_t len) {
+  if (!client || !offset) {
+    LOG_ERR("client_sendfile err: invalid argument");
+    return -1;
+  }
+
+  client_t* inf = (client_t*)client;
+
+  // file data must not overtake queued output
+  if (inf->queue_cnt) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  ssize_t sent = 0;
+  if (!inf->tls && !inf->shm) {
+    sent = sendfile(inf->fd, in_fd, offset, len);
+  } else if (!inf->shm && tls_ktls_send(inf->tls)) {
+    sent = tls_sendfile(inf->tls, in_fd, *offset, len);
+    if (sent > 0) {
+      *offset += sent;
+    }
+  } else {
+    // the records or the ring are filled from userspace, read one record
+    // worth at a time
+    char buf[16 * 1024];
+    const ssize_t n =
+        pread(in_fd, buf, len < sizeof(buf) ? len : sizeof(buf), *offset);
+    if (n <= 0) {
+      return n;
+    }
+    sent = write_entries(inf, buf, (uint32_t)n);
+    if (sent > 0) {
+      *offset += sent;
+    }
+  }
+
+  if (sent == -1 && errno != EAGAIN) {
+    LOG_ERRNO("client_sendfile err");
+  }
+
+  return sent;
+}
+
+uint32_t client_get_capture_id(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->capture_id;
+  }
+
+  return 0;
+}
+
+void client_set_capture_id(void* client, uint32_t id) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->capture_id = id;
+  }
+}
+
+void* client_get_tls(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->tls;
+  }
+
+  return NULL;
+}
+
+void client_set_tls(void* client, void* tls) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->tls = tls;
+  }
+}
+
+void* client_get_shm(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->shm;
+  }
+
+  return NULL;
+}
+
+void client_set_shm(void* client, void* shm) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->shm = shm;
+  }
+}
+
+void client_set_zerocopy_threshold(void* client, uint32_t threshold) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    inf->zc_threshold = threshold;
+  }
+}
+
+static int enable_zerocopy(client_t* inf) {
+  if (!inf->zc_state) {
+    const int one = 1;
+    inf->zc_state =
+        setsockopt(inf->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0
+            ? 1
+            : -1;
+  }
+
+  return inf->zc_state == 1 ? 0 : -1;
+}
+
+static int reserve_zc_buffer(client_t* inf) {
+  if (inf->zc_cnt < inf->zc_cap) {
+    return 0;
+  }
+
+  const uint32_t cap = inf->zc_cap ? inf->zc_cap * 2 : 8;
+  zc_buffer_t* bufs = (zc_buffer_t*)malloc(cap * sizeof(zc_buffer_t));
+  if (!bufs) {
+    LOG_ERR("client_write_zerocopy err: cannot grow buffer list");
+    return -1;
+  }
+
+  uint32_t i = 0;
+  for (; i < inf->zc_cnt; ++i) {
+    bufs[i] = inf->zc_bufs[(inf->zc_head + i) % inf->zc_cap];
+  }
+
+  free(inf->zc_bufs);
+  inf->zc_bufs = bufs;
+  inf->zc_cap = cap;
+  inf->zc_head = 0;
+  return 0;
+}
+
+int client_write_zerocopy(void* client, const void* data, uint32_t len) {
+  if (!client || !data) {
+    LOG_ERR("client_write_zerocopy err: invalid argument");
+    return -1;
+  }
+
+  client_t* inf = (client_t*)client;
+
+  // pinning pages only pays off for large buffers, and never under tls
+  const int copy = len < inf->zc_threshold || inf->tls || inf->shm ||
+                   enable_zerocopy(inf) == -1;
+  if (copy) {
+    // one kernel copy when the socket takes it all, the rest is queued
+    uint32_t sent = 0;
+    if (!inf->queue_cnt && !bypasses_socket(inf)) {
+      const ssize_t n = send(inf->fd, data, len, MSG_NOSIGNAL);
+      if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_ERRNO("client_write_zerocopy err");
+        client_close(inf);
+        return 1;
+      }
+      sent = n > 0 ? (uint32_t)n : 0;
+      if (sent == len) {
+        return 1;
+      }
+    }
+
+    void* payload = payload_create((const char*)data + sent, len - sent);
+    if (!payload) {
+      return -1;
+    }
+    const int result = client_enqueue(inf, payload);
+    payload_unref(payload);
+    if (result == -1) {
+      return -1;
+    }
+  } else {
+    if (reserve_zc_buffer(inf) == -1) {
+      return -1;
+    }
+    send_entry_t* e = reserve_entry(inf);
+    if (!e) {
+      return -1;
+    }
+
+    zc_buffer_t* b = &inf->zc_bufs[(inf->zc_head + inf->zc_cnt) % inf->zc_cap];
+    b->data = data;
+    b->len = len;
+    b->has_ids = 0;
+    inf->zc_cnt++;
+
+    e->payload = NULL;
+    e->zc = (const char*)data;
+    e->len = len;
+    e->off = 0;
+    inf->queue_cnt++;
+    inf->queued_bytes += len;
+  }
+
+  // a dead connection is reaped by the loop, which then releases the buffer
+  if (client_flush(inf) == -1) {
+    client_discard_output(inf);
+    client_close(inf);
+  }
+
+  return copy;
+}
+
+int client_read_zerocopy_completions(void* client, uint32_t* copied) {
+  if (!client) {
+    return -1;
+  }
+
+  client_t* inf = (client_t*)client;
+  char control[256];
+  int reports = 0;
+
+  for (;;) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(inf->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_ERRNO("client_read_zerocopy_completions err");
+        return -1;
+      }
+      return reports;
+    }
+
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    for (; cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+        continue;
+      }
+
+      const struct sock_extended_err* serr =
+          (const struct sock_extended_err*)CMSG_DATA(cm);
+      if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+        continue;
+      }
+
+      // ee_info..ee_data is an inclusive range of completed calls, tcp
+      // reports them in order
+      const uint32_t next = serr->ee_data + 1;
+      if ((int32_t)(next - inf->zc_acked) > 0) {
+        inf->zc_acked = next;
+      }
+      if (copied && (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) {
+        (*copied)++;
+      }
+      reports++;
+    }
+  }
+}
+
+int client_has_zerocopy_pending(void* client) {
+  if (client) {
+    client_t* inf = (client_t*)client;
+    return inf->zc_cnt != 0;
+  }
+
+  return 0;
+}
+
+int client_pop_zerocopy_done(void* client, int force, const void** data,
+                             uint32_t* len) {
+  client_t* inf = (client_t*)client;
+  if (!inf || !inf->zc_cnt) {
+    return -1;
+  }
+
+  if (force) {
+    client_discard_output(inf);
+  }
+
+  zc_buffer_t* b = &inf->zc_bufs[inf->zc_head];
+  if (!force && (!inf->zc_sent ||
+                 (b->has_ids && (int32_t)(b->last_id - inf->zc_acked) >= 0))) {
+    return -1;
+  }
+
+  *data = b->data;
+  *len = b->len;
+  inf->zc_head = (inf->zc_head + 1) % inf->zc_cap;
+  inf->zc_cnt--;
+  inf->zc_sent--;
+  return 0;
+}
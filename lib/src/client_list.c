@@ -2,10 +2,10 @@
 
 #include <errno.h>
 #include <malloc.h>
-#include <stdio.h>
 #include <string.h>
 
 #include "client.h"
+#include "log.h"
 
 typedef struct {
   uint16_t max_cnt;
@@ -17,13 +17,13 @@ void* client_list_create(uint16_t cnt) {
   client_list_t* cl = NULL;
 
   if (cnt == 0) {
-    fprintf(stderr, "invalid maximum client number: %u\n", cnt);
+    LOG_ERR("invalid maximum client number: %u", cnt);
     return NULL;
   }
 
   cl = (client_list_t*)calloc(1, sizeof(client_list_t));
   if (!cl) {
-    fprintf(stderr, "cannot create client list\n");
+    LOG_ERR("cannot create client list");
     goto create_err;
   }
 
@@ -31,7 +31,7 @@ void* client_list_create(uint16_t cnt) {
   cl->cnt = 0;
   cl->list = (void**)calloc(cnt, sizeof(void*));
   if (!cl->list) {
-    fprintf(stderr, "cannot create client list\n");
+    LOG_ERR("cannot create client list");
     goto create_err;
   }
 
@@ -103,20 +103,20 @@ static inline uint16_t find_next_empty_idx(client_list_t* list) {
 
 int client_list_add_client(void* cl, void* ci) {
   if (!cl) {
-    fprintf(stderr, "invalid list object!\n");
+    LOG_ERR("invalid list object!");
     return -1;
   }
 
   client_list_t* list = (client_list_t*)cl;
 
   if (list->cnt == list->max_cnt) {
-    fprintf(stderr, "list is full, cannot add new client!\n");
+    LOG_ERR("list is full, cannot add new client!");
     return -1;
   }
 
   uint16_t idx = find_next_empty_idx(list);
   if (idx > list->max_cnt) {
-    fprintf(stderr, "client not found!\n");
+    LOG_ERR("client not found!");
     return -1;
   }
 
@@ -142,26 +142,33 @@ static inline uint16_t get_client_idx(client_list_t* list, int fd,
       }
       break;
     }
+
+    if (fd != -1 && client_get_deadline_fd(list->list[idx]) == fd) {
+      if (out) {
+        out->type = FD_DEADLINE;
+      }
+      break;
+    }
   }
   return idx;
 }
 
 int client_list_del_client(void* cl, int client_fd) {
   if (!cl) {
-    fprintf(stderr, "invalid list object!\n");
+    LOG_ERR("invalid list object!");
     return -1;
   }
 
   client_list_t* list = (client_list_t*)cl;
 
   if (list->cnt == 0) {
-    fprintf(stderr, "list is empty, cannot delete the client!");
+    LOG_ERR("list is empty, cannot delete the client!");
     return -1;
   }
 
   uint16_t idx = get_client_idx(list, client_fd, NULL);
   if (idx > list->max_cnt) {
-    fprintf(stderr, "client fd [%d] not found!\n", client_fd);
+    LOG_ERR("client fd [%d] not found!", client_fd);
     return -1;
   }
 
@@ -173,14 +180,14 @@ int client_list_del_client(void* cl, int client_fd) {
 
 int client_list_get_client(void* cl, int fd, client_get_result_t* out) {
   if (!cl) {
-    fprintf(stderr, "invalid list object!\n");
+    LOG_ERR("invalid list object!");
     return -1;
   }
 
   client_list_t* list = (client_list_t*)cl;
   uint16_t idx = get_client_idx(list, fd, out);
   if (idx > list->max_cnt) {
-    fprintf(stderr, "client fd [%d] not found!\n", fd);
+    LOG_ERR("client fd [%d] not found!", fd);
     return -1;
   }
   if (out) {
@@ -1,16 +1,35 @@
 #include "epoll_helper.h"
 
 #include <errno.h>
-#include <stdio.h>
 #include <string.h>
 #include <sys/epoll.h>
 
+#include "log.h"
+#include "trace.h"
+
+static inline int traced_epoll_ctl(int epfd, int op, int fd,
+                                   struct epoll_event* ev) {
+  void* trace = trace_get_current();
+  if (!trace) {
+    return epoll_ctl(epfd, op, fd, ev);
+  }
+
+  const uint64_t start = trace_now();
+  const int result = epoll_ctl(epfd, op, fd, ev);
+  trace_record(trace, TRACE_EPOLL_CTL, fd, start, (uint16_t)op);
+  return result;
+}
+
 int epoll_ctl_add(int epfd, int fd, uint32_t events) {
+  return epoll_ctl_add_tagged(epfd, fd, events, (uint32_t)fd);
+}
+
+int epoll_ctl_add_tagged(int epfd, int fd, uint32_t events, uint64_t tag) {
   struct epoll_event ev;
   ev.events = events;
-  ev.data.fd = fd;
-  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
-    fprintf(stderr, "epoll_ctl error: [%s]\n", strerror(errno));
+  ev.data.u64 = tag;
+  if (traced_epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    LOG_ERRNO("epoll_ctl error");
     return -1;
   }
 
@@ -18,8 +37,8 @@ int epoll_ctl_add(int epfd, int fd, uint32_t events) {
 }
 
 int epoll_ctl_del(int epfd, int fd) {
-  if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == -1) {
-    fprintf(stderr, "epoll_ctl error: [%s]\n", strerror(errno));
+  if (traced_epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+    LOG_ERRNO("epoll_ctl error");
     return -1;
   }
 
@@ -27,11 +46,15 @@ int epoll_ctl_del(int epfd, int fd) {
 }
 
 int epoll_ctl_change(int epfd, int fd, uint32_t events) {
+  return epoll_ctl_change_tagged(epfd, fd, events, (uint32_t)fd);
+}
+
+int epoll_ctl_change_tagged(int epfd, int fd, uint32_t events, uint64_t tag) {
   struct epoll_event ev;
   ev.events = events;
-  ev.data.fd = fd;
-  if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
-    fprintf(stderr, "epoll_ctl error: [%s]\n", strerror(errno));
+  ev.data.u64 = tag;
+  if (traced_epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+    LOG_ERRNO("epoll_ctl error");
     return -1;
   }
 
@@ -0,0 +1,239 @@
+#include "group.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include "client.h"
+#include "log.h"
+
+// a membership is linked both into the member list of its group and into
+// the membership list of its client, so either side can drop it in O(1)
+typedef struct membership {
+  void* group;
+  void* client;
+  struct membership* prev;
+  struct membership* next;
+  struct membership* client_next;
+  int dead;  // left during a walk, unlinked from the group once it ends
+} membership_t;
+
+typedef struct {
+  char* name;
+  uint32_t cnt;
+  int dirty;
+  uint32_t walking;
+  uint32_t dead_cnt;
+  membership_t* head;
+} group_t;
+
+void* group_create(const char* name) {
+  group_t* g = NULL;
+
+  if (!name) {
+    LOG_ERR("invalid group name");
+    return NULL;
+  }
+
+  g = (group_t*)calloc(1, sizeof(group_t));
+  if (!g) {
+    LOG_ERR("cannot create group");
+    goto create_err;
+  }
+
+  g->name = strdup(name);
+  if (!g->name) {
+    LOG_ERR("cannot create group");
+    goto create_err;
+  }
+
+  return g;
+
+create_err:
+  group_destroy(g);
+  return NULL;
+}
+
+static void drop_membership(group_t* g, membership_t* m) {
+  if (m->prev) {
+    m->prev->next = m->next;
+  } else {
+    g->head = m->next;
+  }
+  if (m->next) {
+    m->next->prev = m->prev;
+  }
+  free(m);
+}
+
+static void unlink_membership(group_t* g, membership_t* m) {
+  g->cnt--;
+
+  // the client list is singly linked and short, walk it
+  membership_t* it = (membership_t*)client_get_groups(m->client);
+  if (it == m) {
+    client_set_groups(m->client, m->client_next);
+  } else {
+    for (; it; it = it->client_next) {
+      if (it->client_next == m) {
+        it->client_next = m->client_next;
+        break;
+      }
+    }
+  }
+
+  // a walk may be about to step onto it, it stays in the group list until
+  // the walk is over but the client is free to go
+  if (g->walking) {
+    m->dead = 1;
+    m->client = NULL;
+    g->dead_cnt++;
+    return;
+  }
+
+  drop_membership(g, m);
+}
+
+void group_destroy(void* group) {
+  if (group) {
+    group_t* g = (group_t*)group;
+    while (g->head) {
+      if (g->head->dead) {
+        drop_membership(g, g->head);
+      } else {
+        unlink_membership(g, g->head);
+      }
+    }
+    free(g->name);
+    free(g);
+  }
+}
+
+const char* group_get_name(void* group) {
+  if (group) {
+    group_t* g = (group_t*)group;
+    return g->name;
+  }
+
+  return NULL;
+}
+
+uint32_t group_get_count(void* group) {
+  if (group) {
+    group_t* g = (group_t*)group;
+    return g->cnt;
+  }
+
+  return 0;
+}
+
+int group_is_dirty(void* group) {
+  if (group) {
+    group_t* g = (group_t*)group;
+    return g->dirty;
+  }
+
+  return 0;
+}
+
+void group_set_dirty(void* group, int dirty) {
+  if (group) {
+    group_t* g = (group_t*)group;
+    g->dirty = dirty;
+  }
+}
+
+static membership_t* find_membership(void* group, void* client) {
+  membership_t* it = (membership_t*)client_get_groups(client);
+  for (; it; it = it->client_next) {
+    if (it->group == group) {
+      return it;
+    }
+  }
+
+  return NULL;
+}
+
+int group_add_client(void* group, void* client) {
+  if (!group || !client) {
+    LOG_ERR("group_add_client err: invalid argument");
+    return -1;
+  }
+
+  group_t* g = (group_t*)group;
+
+  if (find_membership(group, client)) {
+    return 0;
+  }
+
+  membership_t* m = (membership_t*)calloc(1, sizeof(membership_t));
+  if (!m) {
+    LOG_ERR("group_add_client err: cannot create membership");
+    return -1;
+  }
+
+  m->group = group;
+  m->client = client;
+  m->next = g->head;
+  if (g->head) {
+    g->head->prev = m;
+  }
+  g->head = m;
+  g->cnt++;
+
+  m->client_next = (membership_t*)client_get_groups(client);
+  client_set_groups(client, m);
+
+  return 0;
+}
+
+int group_del_client(void* group, void* client) {
+  if (!group || !client) {
+    LOG_ERR("group_del_client err: invalid argument");
+    return -1;
+  }
+
+  membership_t* m = find_membership(group, client);
+  if (!m) {
+    return -1;
+  }
+
+  unlink_membership((group_t*)group, m);
+  return 0;
+}
+
+void group_leave_all(void* client) {
+  membership_t* m = NULL;
+  while ((m = (membership_t*)client_get_groups(client)) != NULL) {
+    unlink_membership((group_t*)m->group, m);
+  }
+}
+
+void group_foreach(void* group, void (*fn)(void* client, void* arg),
+                   void* arg) {
+  if (!group || !fn) {
+    return;
+  }
+
+  group_t* g = (group_t*)group;
+  membership_t* it = g->head;
+  g->walking++;
+  for (; it; it = it->next) {
+    if (!it->dead) {
+      fn(it->client, arg);
+    }
+  }
+
+  if (--g->walking || !g->dead_cnt) {
+    return;
+  }
+
+  it = g->head;
+  while (it) {
+    membership_t* next = it->next;
+    if (it->dead) {
+      drop_membership(g, it);
+    }
+    it = next;
+  }
+  g->dead_cnt = 0;
+}
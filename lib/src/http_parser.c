@@ -0,0 +1,383 @@
+#include "http_parser.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+enum {
+  CHUNK_SIZE_START = 0,
+  CHUNK_SIZE,
+  CHUNK_EXT,
+  CHUNK_SIZE_LF,
+  CHUNK_DATA,
+  CHUNK_DATA_CR,
+  CHUNK_DATA_LF,
+  CHUNK_TRAILER_START,
+  CHUNK_TRAILER_LINE,
+  CHUNK_TRAILER_LF,
+  CHUNK_END_LF,
+  CHUNK_DONE
+};
+
+// delimiter scans compare 32 or 16 bytes per step, the scalar tail handles
+// whatever is left
+static inline const char* find_char(const char* p, const char* end, char c) {
+#if defined(__AVX2__)
+  const __m256i needle32 = _mm256_set1_epi8(c);
+  for (; end - p >= 32; p += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    const uint32_t mask =
+        (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle32));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i needle16 = _mm_set1_epi8(c);
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)p);
+    const uint32_t mask =
+        (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle16));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; p < end; ++p) {
+    if (*p == c) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static inline http_slice trim(const char* begin, const char* end) {
+  while (begin < end && (*begin == ' ' || *begin == '\t')) {
+    begin++;
+  }
+  while (end > begin &&
+         (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+    end--;
+  }
+  http_slice s = {.ptr = begin, .len = (uint32_t)(end - begin)};
+  return s;
+}
+
+static inline int slice_equals(http_slice s, const char* str) {
+  const size_t len = strlen(str);
+  return s.len == len && strncasecmp(s.ptr, str, len) == 0;
+}
+
+// true if the comma separated list in s ends with token
+static int list_ends_with(http_slice s, const char* token) {
+  const char* begin = s.ptr;
+  const char* end = s.ptr + s.len;
+  const char* comma = NULL;
+  const char* p = begin;
+  while ((p = find_char(p, end, ',')) != NULL) {
+    comma = p++;
+  }
+  return slice_equals(trim(comma ? comma + 1 : begin, end), token);
+}
+
+static int list_contains(http_slice s, const char* token) {
+  const char* p = s.ptr;
+  const char* end = s.ptr + s.len;
+  while (p < end) {
+    const char* comma = find_char(p, end, ',');
+    const char* item_end = comma ? comma : end;
+    if (slice_equals(trim(p, item_end), token)) {
+      return 1;
+    }
+    p = item_end + 1;
+  }
+  return 0;
+}
+
+// token characters of RFC 9112, anything else in a field name (whitespace
+// before the colon above all) would hide the header from the lookups here
+static inline int is_tchar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+static int valid_name(const char* p, const char* end) {
+  for (; p < end; ++p) {
+    if (!is_tchar(*p)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint32_t http_find_head_end(const char* buf, uint32_t len,
+                            uint32_t* scan_pos) {
+  const char* end = buf + len;
+  const char* p = buf + *scan_pos;
+
+  while ((p = find_char(p, end, '\n')) != NULL) {
+    const uint32_t i = p - buf;
+    // an empty line terminates the head, accept bare LF as well
+    if ((i >= 1 && buf[i - 1] == '\n') ||
+        (i >= 2 && buf[i - 1] == '\r' && buf[i - 2] == '\n')) {
+      *scan_pos = i + 1;
+      return i + 1;
+    }
+    p++;
+  }
+
+  *scan_pos = len;
+  return 0;
+}
+
+static int parse_request_line(const char* p, const char* end,
+                              http_request_head* out) {
+  const char* sp = find_char(p, end, ' ');
+  if (!sp || sp == p) {
+    return -1;
+  }
+  out->method.ptr = p;
+  out->method.len = sp - p;
+
+  p = sp + 1;
+  sp = find_char(p, end, ' ');
+  if (!sp || sp == p) {
+    return -1;
+  }
+  out->path.ptr = p;
+  out->path.len = sp - p;
+
+  p = sp + 1;
+  http_slice version = trim(p, end);
+  if (version.len != 8 || strncmp(version.ptr, "HTTP/1.", 7) != 0 ||
+      version.ptr[7] < '0' || version.ptr[7] > '9') {
+    return -1;
+  }
+  out->minor_version = version.ptr[7] - '0';
+  return 0;
+}
+
+int http_parse_request_head(const char* buf, uint32_t head_len,
+                            http_request_head* out) {
+  const char* p = buf;
+  const char* end = buf + head_len;
+
+  memset(out, 0, sizeof(*out));
+
+  const char* nl = find_char(p, end, '\n');
+  if (!nl || parse_request_line(p, nl, out) == -1) {
+    return -1;
+  }
+  out->keep_alive = out->minor_version >= 1;
+
+  int has_length = 0;
+  int has_encoding = 0;
+  for (p = nl + 1; p < end; p = nl + 1) {
+    nl = find_char(p, end, '\n');
+    if (!nl) {
+      return -1;
+    }
+
+    // blank line, end of head
+    if (nl == p || (nl == p + 1 && *p == '\r')) {
+      break;
+    }
+
+    const char* colon = find_char(p, nl, ':');
+    if (!colon || colon == p || !valid_name(p, colon)) {
+      return -1;
+    }
+
+    if (out->header_cnt == HTTP_MAX_HEADERS) {
+      return -1;
+    }
+
+    http_header* h = &out->headers[out->header_cnt++];
+    h->name.ptr = p;
+    h->name.len = colon - p;
+    h->value = trim(colon + 1, nl);
+
+    if (slice_equals(h->name, "content-length")) {
+      uint64_t value = 0;
+      uint32_t i = 0;
+      if (h->value.len == 0 || h->value.len > 19) {
+        return -1;
+      }
+      for (; i < h->value.len; ++i) {
+        const char c = h->value.ptr[i];
+        if (c < '0' || c > '9') {
+          return -1;
+        }
+        value = value * 10 + (c - '0');
+      }
+      // conflicting lengths are a request smuggling vector
+      if (has_length && value != out->content_length) {
+        return -1;
+      }
+      has_length = 1;
+      out->content_length = value;
+    } else if (slice_equals(h->name, "transfer-encoding")) {
+      // repeated headers form one list, its last coding frames the body
+      if (h->value.len) {
+        out->chunked = list_ends_with(h->value, "chunked");
+      }
+      has_encoding = 1;
+    } else if (slice_equals(h->name, "connection")) {
+      if (list_contains(h->value, "close")) {
+        out->keep_alive = 0;
+      } else if (list_contains(h->value, "keep-alive")) {
+        out->keep_alive = 1;
+      }
+    }
+  }
+
+  // a request body is only delimited by chunked as the last coding, and
+  // chunked wins over any length given alongside it; such a request could
+  // be framed differently by a proxy in front, so the connection ends
+  // after it
+  if (has_encoding) {
+    if (!out->chunked) {
+      return -1;
+    }
+    if (has_length) {
+      out->keep_alive = 0;
+    }
+    out->content_length = 0;
+  }
+
+  return 0;
+}
+
+http_slice http_find_header(const http_request_head* head, const char* name) {
+  http_slice empty = {.ptr = NULL, .len = 0};
+  uint32_t i = 0;
+
+  if (!head || !name) {
+    return empty;
+  }
+
+  for (; i < head->header_cnt; ++i) {
+    if (slice_equals(head->headers[i].name, name)) {
+      return head->headers[i].value;
+    }
+  }
+
+  return empty;
+}
+
+void http_chunked_init(http_chunked_decoder* dec) {
+  dec->state = CHUNK_SIZE_START;
+  dec->chunk_left = 0;
+}
+
+static inline int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// framing is strict, every line ends in CRLF and a size has at least one
+// digit, optionally followed by ";ext"; intermediaries that read the body
+// differently could otherwise be fed a smuggled request
+int http_chunked_decode(http_chunked_decoder* dec, char* buf, uint32_t len,
+                        uint32_t* src, uint32_t* dst) {
+  while (*src < len) {
+    const char c = buf[*src];
+
+    switch (dec->state) {
+      case CHUNK_SIZE_START:
+      case CHUNK_SIZE: {
+        const int v = hex_value(c);
+        if (v >= 0) {
+          if (dec->chunk_left > (UINT64_MAX >> 4)) {
+            return -1;
+          }
+          dec->chunk_left = (dec->chunk_left << 4) | v;
+          dec->state = CHUNK_SIZE;
+        } else if (dec->state == CHUNK_SIZE_START) {
+          return -1;
+        } else if (c == ';') {
+          dec->state = CHUNK_EXT;
+        } else if (c == '\r') {
+          dec->state = CHUNK_SIZE_LF;
+        } else {
+          return -1;
+        }
+        (*src)++;
+      } break;
+      case CHUNK_EXT:
+        if (c == '\r') {
+          dec->state = CHUNK_SIZE_LF;
+        } else if (c == '\n') {
+          return -1;
+        }
+        (*src)++;
+        break;
+      case CHUNK_SIZE_LF:
+        if (c != '\n') {
+          return -1;
+        }
+        dec->state = dec->chunk_left ? CHUNK_DATA : CHUNK_TRAILER_START;
+        (*src)++;
+        break;
+      case CHUNK_DATA: {
+        uint64_t avail = len - *src;
+        if (avail > dec->chunk_left) {
+          avail = dec->chunk_left;
+        }
+        memmove(buf + *dst, buf + *src, avail);
+        *dst += avail;
+        *src += avail;
+        dec->chunk_left -= avail;
+        if (dec->chunk_left == 0) {
+          dec->state = CHUNK_DATA_CR;
+        }
+      } break;
+      case CHUNK_DATA_CR:
+      case CHUNK_DATA_LF:
+        if (c != (dec->state == CHUNK_DATA_CR ? '\r' : '\n')) {
+          return -1;
+        }
+        dec->state = dec->state == CHUNK_DATA_CR ? CHUNK_DATA_LF
+                                                 : CHUNK_SIZE_START;
+        (*src)++;
+        break;
+      case CHUNK_TRAILER_START:
+        if (c == '\n') {
+          return -1;
+        }
+        dec->state = c == '\r' ? CHUNK_END_LF : CHUNK_TRAILER_LINE;
+        (*src)++;
+        break;
+      case CHUNK_TRAILER_LINE:
+        if (c == '\r') {
+          dec->state = CHUNK_TRAILER_LF;
+        } else if (c == '\n') {
+          return -1;
+        }
+        (*src)++;
+        break;
+      case CHUNK_TRAILER_LF:
+      case CHUNK_END_LF:
+        if (c != '\n') {
+          return -1;
+        }
+        (*src)++;
+        if (dec->state == CHUNK_END_LF) {
+          dec->state = CHUNK_DONE;
+          return 1;
+        }
+        dec->state = CHUNK_TRAILER_START;
+        break;
+      default:
+        return 1;
+    }
+  }
+
+  return dec->state == CHUNK_DONE ? 1 : 0;
+}
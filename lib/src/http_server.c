@@ -0,0 +1,776 @@
+#include "http_server.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "client.h"
+#include "log.h"
+#include "payload.h"
+#include "tcp_context.h"
+#include "utils.h"
+
+#define DEFAULT_MAX_REQUEST_SIZE (1024 * 1024)
+#define DEFAULT_MAX_PIPELINED 16
+#define READ_CHUNK (16 * 1024)
+#define MAX_RESPONSE_HEAD 1024
+
+typedef enum { CONN_HEAD = 0, CONN_BODY } conn_state;
+typedef enum { TIMER_NONE = 0, TIMER_IDLE, TIMER_HEADER } conn_timer;
+
+struct http_conn;
+
+typedef struct http_request {
+  struct http_server* server;
+  struct http_conn* conn;  // NULL once the connection is gone
+  struct http_request* next;
+  http_request_head head;
+  const char* body;
+  uint32_t body_len;
+  int keep_alive;
+  int minor_version;
+  int no_body;  // HEAD requests get headers only
+  int started;
+  int done;
+  // output produced while earlier requests are still unanswered
+  void** pending;
+  uint32_t pending_cnt;
+  uint32_t pending_cap;
+} http_request_t;
+
+typedef struct http_conn {
+  struct http_server* server;
+  void* client;
+  char* buf;
+  uint32_t len;
+  uint32_t cap;
+  uint32_t start;     // first byte of the request being parsed
+  uint32_t scan_pos;  // head end search position, relative to start
+  conn_state state;
+  http_request_t* cur;  // request whose body is being read
+  uint32_t body_begin;
+  uint32_t body_src;
+  uint32_t body_dst;
+  http_chunked_decoder dec;
+  http_request_t* inflight_head;
+  http_request_t* inflight_tail;
+  uint32_t inflight;
+  int closing;
+  int processing;
+  int read_paused;
+  conn_timer timer;
+} http_conn_t;
+
+typedef struct http_server {
+  void* ctx;
+  http_server_params params;
+} http_server_t;
+
+static void process(http_conn_t* conn);
+
+static const char* reason_phrase(int status) {
+  switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+  }
+}
+
+static void free_request(http_request_t* req) {
+  uint32_t i = 0;
+  for (; i < req->pending_cnt; ++i) {
+    payload_unref(req->pending[i]);
+  }
+  free(req->pending);
+  free(req);
+}
+
+static void update_timer(http_conn_t* conn) {
+  const http_server_params* p = &conn->server->params;
+  conn_timer timer = TIMER_NONE;
+  uint64_t timeout = 0;
+
+  // client_close bounds a closing connection, the timers are left alone
+  if (conn->closing) {
+    return;
+  }
+
+  if (conn->inflight) {
+    timer = TIMER_NONE;
+  } else if (conn->start < conn->len || conn->state == CONN_BODY) {
+    timer = TIMER_HEADER;
+    timeout = p->header_timeout_us;
+  } else {
+    timer = TIMER_IDLE;
+    timeout = p->idle_timeout_us;
+  }
+
+  if (!timeout) {
+    timer = TIMER_NONE;
+  }
+
+  // a running header timer is not extended by further bytes, otherwise a
+  // slow sender could hold the connection forever
+  if (timer == conn->timer && timer != TIMER_IDLE) {
+    return;
+  }
+
+  conn->timer = timer;
+  if (timer == TIMER_NONE) {
+    client_set_timer(conn->client, 0);
+    client_enable_timer(conn->client, 0);
+  } else {
+    client_enable_timer(conn->client, 1);
+    client_set_timer(conn->client, timeout);
+  }
+}
+
+static void update_read(http_conn_t* conn) {
+  const int pause = conn->inflight >= conn->server->params.max_pipelined;
+  if (pause != conn->read_paused && !client_is_closing(conn->client)) {
+    conn->read_paused = pause;
+    client_enable_read(conn->client, !pause);
+  }
+}
+
+static void emit(http_request_t* req, void* payload) {
+  http_conn_t* conn = req->conn;
+
+  if (conn->inflight_head == req) {
+    client_enqueue(conn->client, payload);
+    return;
+  }
+
+  if (req->pending_cnt == req->pending_cap) {
+    const uint32_t cap = req->pending_cap ? req->pending_cap * 2 : 4;
+    void** pending = (void**)realloc(req->pending, cap * sizeof(void*));
+    if (!pending) {
+      LOG_ERR("http emit err: cannot hold back response");
+      return;
+    }
+    req->pending = pending;
+    req->pending_cap = cap;
+  }
+
+  payload_ref(payload);
+  req->pending[req->pending_cnt++] = payload;
+}
+
+// retires answered requests from the front and releases the output that
+// later requests produced in the meantime
+static void advance(http_conn_t* conn) {
+  while (conn->inflight_head) {
+    http_request_t* head = conn->inflight_head;
+
+    uint32_t i = 0;
+    for (; i < head->pending_cnt; ++i) {
+      client_enqueue(conn->client, head->pending[i]);
+      payload_unref(head->pending[i]);
+    }
+    head->pending_cnt = 0;
+
+    if (!head->done) {
+      break;
+    }
+
+    conn->inflight_head = head->next;
+    if (!conn->inflight_head) {
+      conn->inflight_tail = NULL;
+    }
+    conn->inflight--;
+
+    if (!head->keep_alive) {
+      conn->closing = 1;
+      client_close(conn->client);
+    }
+    free_request(head);
+  }
+
+  // responses produced while parsing go out together at the end of it
+  if (!conn->processing) {
+    client_flush(conn->client);
+  }
+}
+
+static int send_data(http_request_t* req, const void* data, uint32_t len) {
+  void* payload = payload_create(data, len);
+  if (!payload) {
+    return -1;
+  }
+
+  emit(req, payload);
+  payload_unref(payload);
+  return 0;
+}
+
+// status line, framing and user headers terminated by the blank line
+static int format_head(http_request_t* req, char* out, size_t size,
+                       int status, const char* headers, const char* framing) {
+  const char* connection = "";
+  if (!req->keep_alive) {
+    connection = "Connection: close\r\n";
+  } else if (req->minor_version == 0) {
+    connection = "Connection: keep-alive\r\n";
+  }
+
+  const int len = snprintf(out, size, "HTTP/1.%d %d %s\r\n%s%s%s\r\n",
+                           req->minor_version, status, reason_phrase(status),
+                           connection, framing, headers ? headers : "");
+  if (len < 0 || (size_t)len >= size) {
+    LOG_ERR("http err: response head too large");
+    return -1;
+  }
+
+  return len;
+}
+
+static int finish(http_request_t* req) {
+  http_conn_t* conn = req->conn;
+  req->done = 1;
+  advance(conn);
+
+  // an asynchronous answer may unblock pipelined requests
+  if (!conn->processing) {
+    process(conn);
+  }
+  return 0;
+}
+
+int http_respond(void* request, int status, const char* headers,
+                 const void* body, uint32_t len) {
+  http_request_t* req = (http_request_t*)request;
+  if (!req || req->started || req->done) {
+    LOG_ERR("http_respond err: invalid request");
+    return -1;
+  }
+
+  if (!req->conn) {
+    free_request(req);
+    return -1;
+  }
+
+  // 1xx, 204 and 304 responses never carry a body nor its length
+  const int bodiless = status < 200 || status == 204 || status == 304;
+  char framing[48] = "";
+  char head[MAX_RESPONSE_HEAD];
+  if (!bodiless) {
+    snprintf(framing, sizeof(framing), "Content-Length: %u\r\n", len);
+  }
+  const int head_len =
+      format_head(req, head, sizeof(head), status, headers, framing);
+  if (head_len == -1) {
+    return -1;
+  }
+
+  // one payload per response so that it is a single queue entry
+  const uint32_t body_len = req->no_body || bodiless ? 0 : len;
+  void* payload = payload_create(NULL, head_len + body_len);
+  if (!payload) {
+    return -1;
+  }
+  char* out = (char*)payload_get_data(payload);
+  memcpy(out, head, head_len);
+  if (body_len) {
+    memcpy(out + head_len, body, body_len);
+  }
+
+  req->started = 1;
+  emit(req, payload);
+  payload_unref(payload);
+  return finish(req);
+}
+
+int http_respond_chunked_begin(void* request, int status,
+                               const char* headers) {
+  http_request_t* req = (http_request_t*)request;
+  if (!req || req->started || req->done) {
+    LOG_ERR("http_respond_chunked_begin err: invalid request");
+    return -1;
+  }
+
+  if (!req->conn) {
+    free_request(req);
+    return -1;
+  }
+
+  // http/1.0 has no chunked coding, the end of the body is the close
+  const char* framing = "Transfer-Encoding: chunked\r\n";
+  if (req->minor_version == 0) {
+    req->keep_alive = 0;
+    framing = "";
+  }
+
+  char head[MAX_RESPONSE_HEAD];
+  const int head_len =
+      format_head(req, head, sizeof(head), status, headers, framing);
+  if (head_len == -1) {
+    return -1;
+  }
+
+  req->started = 1;
+  return send_data(req, head, head_len);
+}
+
+int http_respond_chunk(void* request, const void* data, uint32_t len) {
+  http_request_t* req = (http_request_t*)request;
+  if (!req || !req->started || req->done) {
+    LOG_ERR("http_respond_chunk err: invalid request");
+    return -1;
+  }
+
+  // an empty chunk would terminate the body
+  if (!req->conn || len == 0 || req->no_body) {
+    return req->conn ? 0 : -1;
+  }
+
+  if (req->minor_version == 0) {
+    return send_data(req, data, len);
+  }
+
+  char size[16];
+  const int size_len = snprintf(size, sizeof(size), "%x\r\n", len);
+  void* payload = payload_create(NULL, size_len + len + 2);
+  if (!payload) {
+    return -1;
+  }
+  char* out = (char*)payload_get_data(payload);
+  memcpy(out, size, size_len);
+  memcpy(out + size_len, data, len);
+  memcpy(out + size_len + len, "\r\n", 2);
+
+  emit(req, payload);
+  payload_unref(payload);
+
+  if (req->conn->inflight_head == req) {
+    client_flush(req->conn->client);
+  }
+  return 0;
+}
+
+int http_respond_chunked_end(void* request) {
+  http_request_t* req = (http_request_t*)request;
+  if (!req || !req->started || req->done) {
+    LOG_ERR("http_respond_chunked_end err: invalid request");
+    return -1;
+  }
+
+  if (!req->conn) {
+    free_request(req);
+    return -1;
+  }
+
+  if (req->minor_version != 0 && !req->no_body &&
+      send_data(req, "0\r\n\r\n", 5) == -1) {
+    return -1;
+  }
+
+  return finish(req);
+}
+
+static http_request_t* new_request(http_conn_t* conn) {
+  http_request_t* req = (http_request_t*)calloc(1, sizeof(http_request_t));
+  if (!req) {
+    LOG_ERR("http err: cannot create request");
+    return NULL;
+  }
+
+  req->server = conn->server;
+  req->conn = conn;
+  req->keep_alive = 1;
+  req->minor_version = 1;
+  return req;
+}
+
+static void dispatch(http_conn_t* conn, http_request_t* req) {
+  if (conn->inflight_tail) {
+    conn->inflight_tail->next = req;
+  } else {
+    conn->inflight_head = req;
+  }
+  conn->inflight_tail = req;
+  conn->inflight++;
+
+  // nothing after a closing request is read
+  if (!req->keep_alive) {
+    conn->closing = 1;
+  }
+
+  conn->server->params.on_request(req);
+}
+
+// answers a protocol error on behalf of the application and closes
+static void fail(http_conn_t* conn, int status) {
+  http_request_t* req = new_request(conn);
+  conn->closing = 1;
+  if (!req) {
+    client_close(conn->client);
+    return;
+  }
+
+  req->keep_alive = 0;
+  if (conn->inflight_tail) {
+    conn->inflight_tail->next = req;
+  } else {
+    conn->inflight_head = req;
+  }
+  conn->inflight_tail = req;
+  conn->inflight++;
+
+  http_respond(req, status, NULL, NULL, 0);
+}
+
+static int begin_request(http_conn_t* conn, uint32_t head_len) {
+  http_request_t* req = new_request(conn);
+  if (!req) {
+    return -1;
+  }
+
+  if (http_parse_request_head(conn->buf + conn->start, head_len, &req->head) ==
+      -1) {
+    free_request(req);
+    fail(conn, 400);
+    return -1;
+  }
+
+  req->keep_alive = req->head.keep_alive;
+  req->minor_version = req->head.minor_version;
+  req->no_body = req->head.method.len == 4 &&
+                 memcmp(req->head.method.ptr, "HEAD", 4) == 0;
+
+  if (req->head.content_length > conn->server->params.max_request_size) {
+    free_request(req);
+    fail(conn, 413);
+    return -1;
+  }
+
+  conn->cur = req;
+  conn->body_begin = conn->start + head_len;
+  conn->body_src = conn->body_begin;
+  conn->body_dst = conn->body_begin;
+  http_chunked_init(&conn->dec);
+  conn->state = CONN_BODY;
+  return 0;
+}
+
+// returns 1 when the body of the current request is complete
+static int read_body(http_conn_t* conn) {
+  http_request_t* req = conn->cur;
+
+  if (req->head.chunked) {
+    const int r = http_chunked_decode(&conn->dec, conn->buf, conn->len,
+                                      &conn->body_src, &conn->body_dst);
+    if (r == -1 || conn->body_dst - conn->body_begin >
+                       conn->server->params.max_request_size) {
+      conn->cur = NULL;
+      free_request(req);
+      fail(conn, r == -1 ? 400 : 413);
+      return -1;
+    }
+    if (r == 0) {
+      return 0;
+    }
+
+    req->body_len = conn->body_dst - conn->body_begin;
+    conn->start = conn->body_src;
+  } else {
+    if (conn->len - conn->body_begin < req->head.content_length) {
+      return 0;
+    }
+
+    req->body_len = (uint32_t)req->head.content_length;
+    conn->start = conn->body_begin + req->body_len;
+  }
+
+  req->body = req->body_len ? conn->buf + conn->body_begin : NULL;
+  return 1;
+}
+
+static void process(http_conn_t* conn) {
+  const uint32_t max_pipelined = conn->server->params.max_pipelined;
+
+  conn->processing = 1;
+
+  while (!conn->closing && conn->inflight < max_pipelined) {
+    if (conn->state == CONN_HEAD) {
+      if (conn->start == conn->len) {
+        break;
+      }
+
+      const uint32_t head_len = http_find_head_end(
+          conn->buf + conn->start, conn->len - conn->start, &conn->scan_pos);
+      if (!head_len) {
+        if (conn->len - conn->start > conn->server->params.max_request_size) {
+          fail(conn, 431);
+        }
+        break;
+      }
+
+      conn->scan_pos = 0;
+      if (begin_request(conn, head_len) == -1) {
+        break;
+      }
+    }
+
+    const int r = read_body(conn);
+    if (r != 1) {
+      break;
+    }
+
+    http_request_t* req = conn->cur;
+    conn->cur = NULL;
+    conn->state = CONN_HEAD;
+    dispatch(conn, req);
+  }
+
+  conn->processing = 0;
+
+  client_flush(conn->client);
+
+  // keep the unparsed tail at the front, slices handed out above are dead
+  if (conn->state == CONN_HEAD && conn->start) {
+    memmove(conn->buf, conn->buf + conn->start, conn->len - conn->start);
+    conn->len -= conn->start;
+    conn->start = 0;
+  }
+
+  update_read(conn);
+  update_timer(conn);
+}
+
+// received bytes are copied once into the connection buffer, which keeps
+// them across reads; heads and bodies are then parsed there in place
+static int append(http_conn_t* conn, const void* in, uint32_t len) {
+  if (conn->len + len > conn->cap) {
+    uint32_t cap = conn->cap ? conn->cap : READ_CHUNK;
+    while (cap < conn->len + len) {
+      cap *= 2;
+    }
+    char* buf = (char*)realloc(conn->buf, cap);
+    if (!buf) {
+      LOG_ERR("http err: cannot grow connection buffer");
+      return -1;
+    }
+    conn->buf = buf;
+    conn->cap = cap;
+  }
+
+  memcpy(conn->buf + conn->len, in, len);
+  conn->len += len;
+  return 0;
+}
+
+static void destroy_conn(http_conn_t* conn) {
+  http_request_t* req = conn->inflight_head;
+
+  // unanswered requests stay with the application, answering them later
+  // only releases them
+  while (req) {
+    http_request_t* next = req->next;
+    uint32_t i = 0;
+    for (; i < req->pending_cnt; ++i) {
+      payload_unref(req->pending[i]);
+    }
+    req->pending_cnt = 0;
+    req->conn = NULL;
+    req->next = NULL;
+    if (req->done) {
+      free_request(req);
+    }
+    req = next;
+  }
+
+  if (conn->cur) {
+    free_request(conn->cur);
+  }
+
+  free(conn->buf);
+  free(conn);
+}
+
+static void http_callback(const event_type ev, void* client, const void* in,
+                          const uint32_t len) {
+  http_conn_t* conn = (http_conn_t*)client_get_user_data(client);
+
+  switch (ev) {
+    case EVT_CLIENT_CONNECTED: {
+      http_server_t* server =
+          (http_server_t*)tcp_context_get_user(client_get_context(client));
+      conn = (http_conn_t*)calloc(1, sizeof(http_conn_t));
+      if (!conn) {
+        LOG_ERR("http err: cannot create connection");
+        client_close(client);
+        return;
+      }
+      conn->server = server;
+      conn->client = client;
+      // responses are batched already, nagle would only add latency
+      set_socket_nodelay(client_get_fd(client));
+      client_set_user_data(client, conn);
+      update_timer(conn);
+    } break;
+    case EVT_CLIENT_DATA_RECEIVED:
+      if (!conn || conn->closing) {
+        return;
+      }
+      if (append(conn, in, len) == -1) {
+        conn->closing = 1;
+        client_close(client);
+        return;
+      }
+      process(conn);
+      break;
+    case EVT_CLIENT_TIMER_EXPIRED:
+      if (conn) {
+        conn->timer = TIMER_NONE;
+        conn->closing = 1;
+        client_close(client);
+      }
+      break;
+    case EVT_CLIENT_DISCONNECTED:
+      if (conn) {
+        client_set_user_data(client, NULL);
+        destroy_conn(conn);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void* http_server_create(http_server_params params) {
+  http_server_t* server = NULL;
+
+  if (!params.on_request) {
+    LOG_ERR("http_server_create err: no request handler");
+    return NULL;
+  }
+
+  server = (http_server_t*)calloc(1, sizeof(http_server_t));
+  if (!server) {
+    LOG_ERR("http_server_create err: cannot create server");
+    goto create_error;
+  }
+
+  if (!params.max_request_size) {
+    params.max_request_size = DEFAULT_MAX_REQUEST_SIZE;
+  }
+  if (!params.max_pipelined) {
+    params.max_pipelined = DEFAULT_MAX_PIPELINED;
+  }
+  server->params = params;
+
+  tcp_context_params ctx_params = {.port = params.port,
+                                   .max_client_count = params.max_client_count,
+                                   .callback = http_callback,
+                                   .options = params.options,
+                                   .cpu = params.cpu,
+                                   .user = server};
+
+  server->ctx = tcp_context_create(ctx_params);
+  if (!server->ctx) {
+    goto create_error;
+  }
+
+  return server;
+
+create_error:
+  http_server_destroy(server);
+  return NULL;
+}
+
+void http_server_destroy(void* server) {
+  if (server) {
+    http_server_t* s = (http_server_t*)server;
+    tcp_context_destroy(s->ctx);
+    free(s);
+  }
+}
+
+int http_server_service(void* server, int timeout_ms) {
+  if (!server) {
+    return -1;
+  }
+
+  http_server_t* s = (http_server_t*)server;
+  return tcp_context_service(s->ctx, timeout_ms);
+}
+
+void* http_server_get_context(void* server) {
+  if (server) {
+    http_server_t* s = (http_server_t*)server;
+    return s->ctx;
+  }
+
+  return NULL;
+}
+
+void* http_server_get_user(void* server) {
+  if (server) {
+    http_server_t* s = (http_server_t*)server;
+    return s->params.user;
+  }
+
+  return NULL;
+}
+
+void* http_request_get_server(void* req) {
+  if (req) {
+    http_request_t* r = (http_request_t*)req;
+    return r->server;
+  }
+
+  return NULL;
+}
+
+void* http_request_get_client(void* req) {
+  if (req) {
+    http_request_t* r = (http_request_t*)req;
+    return r->conn ? r->conn->client : NULL;
+  }
+
+  return NULL;
+}
+
+const http_request_head* http_request_get_head(void* req) {
+  if (req) {
+    http_request_t* r = (http_request_t*)req;
+    return &r->head;
+  }
+
+  return NULL;
+}
+
+const char* http_request_get_body(void* req) {
+  if (req) {
+    http_request_t* r = (http_request_t*)req;
+    return r->body;
+  }
+
+  return NULL;
+}
+
+uint32_t http_request_get_body_len(void* req) {
+  if (req) {
+    http_request_t* r = (http_request_t*)req;
+    return r->body_len;
+  }
+
+  return 0;
+}
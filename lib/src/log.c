@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include "log.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RING_SIZE 1024
+#define MAX_MESSAGE 512
+#define DEFAULT_RATE_LIMIT 100
+
+typedef struct {
+  uint64_t ts_ns;
+  const char* fmt;
+  int32_t level;
+  int32_t err;
+  uint32_t nargs;
+  uint32_t suppressed;
+  uint64_t args[LOG_MAX_ARGS];
+} log_record_t;
+
+// single producer (the owning thread), single consumer (whoever holds
+// flush_lock), records are published by the release store of head
+typedef struct log_ring {
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  _Atomic uint64_t dropped;
+  _Atomic int dead;
+  int reap;  // dead before its last drain, only touched by the flusher
+  struct log_ring* next;
+  log_record_t records[RING_SIZE];
+} log_ring_t;
+
+static _Atomic int g_level = LOG_LEVEL_WARN;
+static _Atomic uint32_t g_rate_limit = DEFAULT_RATE_LIMIT;
+static log_sink g_sink;
+static void* g_sink_arg;
+
+static pthread_mutex_t g_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t* g_rings;
+static pthread_key_t g_ring_key;
+static pthread_once_t g_ring_once = PTHREAD_ONCE_INIT;
+static __thread log_ring_t* t_ring;
+
+static pthread_t g_thread;
+static _Atomic int g_thread_running;
+static uint32_t g_interval_ms;
+
+static void ring_release(void* ring) {
+  // the flusher frees the ring once it has drained it
+  atomic_store_explicit(&((log_ring_t*)ring)->dead, 1, memory_order_release);
+}
+
+static void flush_at_exit(void) { log_flush(); }
+
+static void init_once(void) {
+  pthread_key_create(&g_ring_key, ring_release);
+  atexit(flush_at_exit);
+}
+
+static log_ring_t* get_ring(void) {
+  if (t_ring) {
+    return t_ring;
+  }
+
+  pthread_once(&g_ring_once, init_once);
+
+  log_ring_t* ring = (log_ring_t*)calloc(1, sizeof(log_ring_t));
+  if (!ring) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&g_rings_lock);
+  ring->next = g_rings;
+  g_rings = ring;
+  pthread_mutex_unlock(&g_rings_lock);
+
+  pthread_setspecific(g_ring_key, ring);
+  t_ring = ring;
+  return ring;
+}
+
+static inline uint64_t coarse_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// fixed one second windows, racy across threads by design: an occasional
+// extra record is cheaper than a lock on the error path
+static int rate_limited(log_site_t* site, uint32_t* suppressed) {
+  const uint32_t limit =
+      atomic_load_explicit(&g_rate_limit, memory_order_relaxed);
+  if (!limit) {
+    *suppressed = 0;
+    return 0;
+  }
+
+  const uint64_t window = coarse_now_ns() / 1000000000ull;
+  if (site->window != window) {
+    site->window = window;
+    site->count = 0;
+  }
+
+  if (site->count >= limit) {
+    site->suppressed++;
+    return 1;
+  }
+
+  site->count++;
+  *suppressed = site->suppressed;
+  site->suppressed = 0;
+  return 0;
+}
+
+void log_write(log_site_t* site, int level, int err, const char* fmt,
+               uint32_t nargs, const uint64_t* args) {
+  uint32_t suppressed = 0;
+  if (rate_limited(site, &suppressed)) {
+    return;
+  }
+
+  log_ring_t* ring = get_ring();
+  if (!ring) {
+    return;
+  }
+
+  const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail == RING_SIZE) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+  log_record_t* rec = &ring->records[head % RING_SIZE];
+  rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  rec->fmt = fmt;
+  rec->level = level;
+  rec->err = err;
+  rec->nargs = nargs > LOG_MAX_ARGS ? LOG_MAX_ARGS : nargs;
+  rec->suppressed = suppressed;
+  memcpy(rec->args, args, rec->nargs * sizeof(uint64_t));
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int log_get_level(void) {
+  return atomic_load_explicit(&g_level, memory_order_relaxed);
+}
+
+void log_set_level(int level) {
+  atomic_store_explicit(&g_level, level, memory_order_relaxed);
+}
+
+void log_set_rate_limit(uint32_t per_sec) {
+  atomic_store_explicit(&g_rate_limit, per_sec, memory_order_relaxed);
+}
+
+void log_set_sink(log_sink sink, void* arg) {
+  pthread_mutex_lock(&g_flush_lock);
+  g_sink = sink;
+  g_sink_arg = arg;
+  pthread_mutex_unlock(&g_flush_lock);
+}
+
+// printf for the integer conversions, each argument is cast back to the
+// type its conversion spec asks for
+static size_t format_args(char* out, size_t size, const char* fmt,
+                          const uint64_t* args, uint32_t nargs) {
+  size_t len = 0;
+  uint32_t arg = 0;
+  const char* p = fmt;
+
+  while (*p && len + 1 < size) {
+    if (*p != '%') {
+      out[len++] = *p++;
+      continue;
+    }
+
+    if (p[1] == '%') {
+      out[len++] = '%';
+      p += 2;
+      continue;
+    }
+
+    // copy "%[flags][width][.prec][length]conv" into its own format
+    char spec[16];
+    size_t n = 0;
+    const char* s = p++;
+    while (*p && strchr("-+ #0123456789.", *p)) p++;
+    while (*p && strchr("hlzjt", *p)) p++;
+    if (!*p) {
+      break;
+    }
+    const char conv = *p++;
+    n = p - s;
+    if (n >= sizeof(spec)) {
+      break;
+    }
+    memcpy(spec, s, n);
+    spec[n] = '\0';
+
+    const uint64_t v = arg < nargs ? args[arg++] : 0;
+    const int longs = (strstr(spec, "ll") || strchr(spec, 'j') ||
+                       strchr(spec, 'z') || strchr(spec, 't'))
+                          ? 2
+                          : (strchr(spec, 'l') ? 1 : 0);
+    int w = 0;
+    switch (conv) {
+      case 'd':
+      case 'i':
+        w = longs == 2   ? snprintf(out + len, size - len, spec, (long long)v)
+            : longs == 1 ? snprintf(out + len, size - len, spec, (long)v)
+                         : snprintf(out + len, size - len, spec, (int)v);
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        w = longs == 2 ? snprintf(out + len, size - len, spec,
+                                  (unsigned long long)v)
+            : longs == 1
+                ? snprintf(out + len, size - len, spec, (unsigned long)v)
+                : snprintf(out + len, size - len, spec, (unsigned int)v);
+        break;
+      case 'c':
+        w = snprintf(out + len, size - len, spec, (int)v);
+        break;
+      case 'p':
+        w = snprintf(out + len, size - len, spec, (void*)(uintptr_t)v);
+        break;
+      default:
+        w = snprintf(out + len, size - len, "%s", spec);
+        break;
+    }
+
+    if (w < 0) {
+      break;
+    }
+    len += (size_t)w < size - len ? (size_t)w : size - len - 1;
+  }
+
+  out[len] = '\0';
+  return len;
+}
+
+static void emit(int level, const char* msg) {
+  if (g_sink) {
+    g_sink(level, msg, g_sink_arg);
+  } else {
+    fprintf(stderr, "%s\n", msg);
+  }
+}
+
+static void format_record(const log_record_t* rec) {
+  char msg[MAX_MESSAGE];
+  size_t len = format_args(msg, sizeof(msg), rec->fmt, rec->args, rec->nargs);
+
+  if (rec->err && len + 1 < sizeof(msg)) {
+    char buf[128];
+    const char* reason = strerror_r(rec->err, buf, sizeof(buf));
+    len += snprintf(msg + len, sizeof(msg) - len, ": %s", reason);
+  }
+
+  if (rec->suppressed && len + 1 < sizeof(msg)) {
+    snprintf(msg + len, sizeof(msg) - len, " (%u similar suppressed)",
+             rec->suppressed);
+  }
+
+  emit(rec->level, msg);
+}
+
+static void drain(log_ring_t* ring) {
+  const uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  for (; tail < head; ++tail) {
+    format_record(&ring->records[tail % RING_SIZE]);
+  }
+  atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+  const uint64_t dropped =
+      atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+  if (dropped) {
+    char msg[64];
+    snprintf(msg, sizeof(msg), "log ring full, %llu records dropped",
+             (unsigned long long)dropped);
+    emit(LOG_LEVEL_WARN, msg);
+  }
+}
+
+void log_flush(void) {
+  pthread_mutex_lock(&g_flush_lock);
+
+  // new rings are only ever prepended and only the flusher unlinks them, so
+  // the list past the head taken here is walked without g_rings_lock; a
+  // slow sink thus never blocks threads logging for the first time
+  pthread_mutex_lock(&g_rings_lock);
+  log_ring_t* first = g_rings;
+  pthread_mutex_unlock(&g_rings_lock);
+
+  log_ring_t* ring = first;
+  int reap = 0;
+  for (; ring; ring = ring->next) {
+    // a ring seen dead before the drain gets no records after it
+    ring->reap = atomic_load_explicit(&ring->dead, memory_order_acquire);
+    reap |= ring->reap;
+    drain(ring);
+  }
+
+  if (reap) {
+    pthread_mutex_lock(&g_rings_lock);
+    log_ring_t** it = &g_rings;
+    while (*it) {
+      ring = *it;
+      if (ring->reap) {
+        *it = ring->next;
+        free(ring);
+        continue;
+      }
+      it = &ring->next;
+    }
+    pthread_mutex_unlock(&g_rings_lock);
+  }
+
+  pthread_mutex_unlock(&g_flush_lock);
+}
+
+void log_poll(void) {
+  if (atomic_load_explicit(&g_thread_running, memory_order_relaxed)) {
+    return;
+  }
+
+  log_ring_t* ring = t_ring;
+  if (ring && atomic_load_explicit(&ring->head, memory_order_relaxed) !=
+                  atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+    log_flush();
+  }
+}
+
+static void* flush_thread(void* arg) {
+  const struct timespec interval = {
+      .tv_sec = g_interval_ms / 1000,
+      .tv_nsec = (long)(g_interval_ms % 1000) * 1000000};
+
+  while (atomic_load(&g_thread_running)) {
+    nanosleep(&interval, NULL);
+    log_flush();
+  }
+
+  return NULL;
+}
+
+int log_start_thread(uint32_t interval_ms) {
+  if (atomic_exchange(&g_thread_running, 1)) {
+    return 0;
+  }
+
+  g_interval_ms = interval_ms ? interval_ms : 1;
+  if (pthread_create(&g_thread, NULL, flush_thread, NULL) != 0) {
+    atomic_store(&g_thread_running, 0);
+    return -1;
+  }
+
+  return 0;
+}
+
+void log_stop_thread(void) {
+  if (atomic_exchange(&g_thread_running, 0)) {
+    pthread_join(g_thread, NULL);
+    log_flush();
+  }
+}
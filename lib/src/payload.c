@@ -0,0 +1,62 @@
+#include "payload.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include "log.h"
+
+typedef struct {
+  uint32_t refcnt;
+  uint32_t len;
+  char data[];
+} payload_t;
+
+void* payload_create(const void* data, uint32_t len) {
+  payload_t* p = (payload_t*)malloc(sizeof(payload_t) + len);
+  if (!p) {
+    LOG_ERR("cannot create payload of %u bytes", len);
+    return NULL;
+  }
+
+  p->refcnt = 1;
+  p->len = len;
+  if (data && len) {
+    memcpy(p->data, data, len);
+  }
+
+  return p;
+}
+
+void payload_ref(void* payload) {
+  if (payload) {
+    payload_t* p = (payload_t*)payload;
+    p->refcnt++;
+  }
+}
+
+void payload_unref(void* payload) {
+  if (payload) {
+    payload_t* p = (payload_t*)payload;
+    if (--p->refcnt == 0) {
+      free(p);
+    }
+  }
+}
+
+const char* payload_get_data(void* payload) {
+  if (payload) {
+    payload_t* p = (payload_t*)payload;
+    return p->data;
+  }
+
+  return NULL;
+}
+
+uint32_t payload_get_len(void* payload) {
+  if (payload) {
+    payload_t* p = (payload_t*)payload;
+    return p->len;
+  }
+
+  return 0;
+}
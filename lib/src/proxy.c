@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include "proxy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "log.h"
+
+#define PIPE_SIZE (256 * 1024)
+
+// one direction of the pair, bytes sit in the pipe between the two splices
+typedef struct {
+  void* src;
+  void* dst;
+  int pipe[2];
+  uint32_t capacity;
+  uint32_t buffered;
+  int src_eof;
+  int dst_shut;
+} direction_t;
+
+typedef struct {
+  direction_t dir[2];
+} proxy_t;
+
+static int open_pipe(direction_t* d) {
+  if (pipe2(d->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+    LOG_ERRNO("proxy pipe err");
+    d->pipe[0] = d->pipe[1] = -1;
+    return -1;
+  }
+
+  // a larger pipe means fewer wakeups per byte, the default is kept when
+  // the system limit does not allow it
+  fcntl(d->pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+  const int size = fcntl(d->pipe[1], F_GETPIPE_SZ);
+  d->capacity = size > 0 ? (uint32_t)size : 65536;
+  return 0;
+}
+
+void* proxy_create(void* a, void* b) {
+  proxy_t* p = NULL;
+
+  if (!a || !b || a == b) {
+    LOG_ERR("proxy_create err: invalid clients");
+    return NULL;
+  }
+
+  p = (proxy_t*)calloc(1, sizeof(proxy_t));
+  if (!p) {
+    LOG_ERR("proxy_create err: cannot create proxy");
+    goto create_err;
+  }
+
+  p->dir[0].src = a;
+  p->dir[0].dst = b;
+  p->dir[1].src = b;
+  p->dir[1].dst = a;
+  p->dir[0].pipe[0] = p->dir[0].pipe[1] = -1;
+  p->dir[1].pipe[0] = p->dir[1].pipe[1] = -1;
+
+  if (open_pipe(&p->dir[0]) == -1 || open_pipe(&p->dir[1]) == -1) {
+    goto create_err;
+  }
+
+  return p;
+
+create_err:
+  proxy_destroy(p);
+  return NULL;
+}
+
+void proxy_destroy(void* proxy) {
+  if (proxy) {
+    proxy_t* p = (proxy_t*)proxy;
+    int i = 0;
+    for (; i < 2; ++i) {
+      if (p->dir[i].pipe[0] != -1) {
+        close(p->dir[i].pipe[0]);
+      }
+      if (p->dir[i].pipe[1] != -1) {
+        close(p->dir[i].pipe[1]);
+      }
+    }
+    free(p);
+  }
+}
+
+void* proxy_get_peer(void* proxy, void* client) {
+  if (proxy) {
+    proxy_t* p = (proxy_t*)proxy;
+    if (p->dir[0].src == client) {
+      return p->dir[0].dst;
+    }
+    if (p->dir[1].src == client) {
+      return p->dir[1].dst;
+    }
+  }
+
+  return NULL;
+}
+
+static int pump_direction(direction_t* d) {
+  // a side still connecting can neither be read nor written
+  if (client_is_connecting(d->src) || client_is_connecting(d->dst)) {
+    return 0;
+  }
+
+  const int src_fd = client_get_fd(d->src);
+  const int dst_fd = client_get_fd(d->dst);
+  int progress = 1;
+
+  while (progress) {
+    progress = 0;
+
+    if (!d->src_eof && d->buffered < d->capacity) {
+      ssize_t n = splice(src_fd, NULL, d->pipe[1], NULL,
+                         d->capacity - d->buffered,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        d->buffered += n;
+        progress = 1;
+      } else if (n == 0) {
+        d->src_eof = 1;
+      } else if (errno != EAGAIN) {
+        LOG_ERRNO("proxy splice in err");
+        return -1;
+      }
+    }
+
+    if (d->buffered) {
+      ssize_t n = splice(d->pipe[0], NULL, dst_fd, NULL, d->buffered,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        d->buffered -= n;
+        progress = 1;
+      } else if (n == -1 && errno != EAGAIN) {
+        LOG_ERRNO("proxy splice out err");
+        return -1;
+      }
+    }
+  }
+
+  // forward the half-close once everything before it was delivered
+  if (d->src_eof && !d->buffered && !d->dst_shut) {
+    shutdown(dst_fd, SHUT_WR);
+    d->dst_shut = 1;
+  }
+
+  return 0;
+}
+
+// the source is read only while the pipe has room and the destination is
+// polled for writability only while bytes wait, a slow peer thus stops
+// reads on the other side; nothing is read before the peer is connected,
+// level-triggered readiness would only spin the loop
+static void update_interest(proxy_t* p, void* client) {
+  if (client_is_connecting(client)) {
+    return;
+  }
+
+  const direction_t* out = p->dir[0].src == client ? &p->dir[0] : &p->dir[1];
+  const direction_t* in = p->dir[0].dst == client ? &p->dir[0] : &p->dir[1];
+
+  const int want_in = !client_is_connecting(out->dst) && !out->src_eof &&
+                      out->buffered < out->capacity;
+  const int want_out = in->buffered > 0;
+
+  client_set_interest(client, want_in, want_out);
+}
+
+int proxy_pump(void* proxy) {
+  if (!proxy) {
+    return -1;
+  }
+
+  proxy_t* p = (proxy_t*)proxy;
+
+  if (pump_direction(&p->dir[0]) == -1 || pump_direction(&p->dir[1]) == -1) {
+    return -1;
+  }
+
+  if (p->dir[0].dst_shut && p->dir[1].dst_shut) {
+    return 1;
+  }
+
+  update_interest(p, p->dir[0].src);
+  update_interest(p, p->dir[1].src);
+  return 0;
+}
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include "replay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "client.h"
+#include "log.h"
+
+#define HEADER_SIZE 24
+
+typedef struct {
+  const uint8_t* p;
+  const uint8_t* end;
+} reader_t;
+
+typedef struct {
+  int efd;
+  // every client writes into this socket pair, it is drained; a socket
+  // because clients send with socket flags
+  int sink[2];
+  void** clients;
+  uint32_t client_cap;
+  uint32_t* latencies;
+  uint64_t latency_cnt;
+  uint64_t latency_cap;
+  char scratch[64 * 1024];
+} replay_t;
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int get_varint(reader_t* r, uint64_t* out) {
+  uint64_t v = 0;
+  uint32_t shift = 0;
+  while (r->p < r->end && shift < 64) {
+    const uint8_t b = *r->p++;
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *out = v;
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+static void** client_slot(replay_t* rp, uint64_t id) {
+  if (id == 0 || id > UINT32_MAX) {
+    return NULL;
+  }
+
+  if (id >= rp->client_cap) {
+    uint32_t cap = rp->client_cap ? rp->client_cap : 64;
+    while (cap <= id) {
+      cap *= 2;
+    }
+    void** clients = (void**)realloc(rp->clients, cap * sizeof(void*));
+    if (!clients) {
+      LOG_ERR("replay err: cannot grow client table");
+      return NULL;
+    }
+    memset(clients + rp->client_cap, 0,
+           (cap - rp->client_cap) * sizeof(void*));
+    rp->clients = clients;
+    rp->client_cap = cap;
+  }
+
+  return &rp->clients[id];
+}
+
+static void* create_client(replay_t* rp, const char* ip, uint16_t port) {
+  const int fd = fcntl(rp->sink[1], F_DUPFD_CLOEXEC, 0);
+  if (fd == -1) {
+    LOG_ERRNO("replay err");
+    return NULL;
+  }
+
+  void* client = client_create(rp->efd, fd, ip, port);
+  if (!client) {
+    close(fd);
+  }
+  return client;
+}
+
+static void record_latency(replay_t* rp, uint64_t ns) {
+  if (rp->latency_cnt == rp->latency_cap) {
+    const uint64_t cap = rp->latency_cap ? rp->latency_cap * 2 : 4096;
+    uint32_t* l = (uint32_t*)realloc(rp->latencies, cap * sizeof(uint32_t));
+    if (!l) {
+      return;
+    }
+    rp->latencies = l;
+    rp->latency_cap = cap;
+  }
+
+  rp->latencies[rp->latency_cnt++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+static int cmp_u32(const void* a, const void* b) {
+  const uint32_t x = *(const uint32_t*)a;
+  const uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void finish_stats(replay_t* rp, replay_stats* st) {
+  if (!rp->latency_cnt) {
+    return;
+  }
+
+  qsort(rp->latencies, rp->latency_cnt, sizeof(uint32_t), cmp_u32);
+  st->latency_p50_ns = rp->latencies[rp->latency_cnt / 2];
+  st->latency_p99_ns = rp->latencies[rp->latency_cnt * 99 / 100];
+  st->latency_max_ns = rp->latencies[rp->latency_cnt - 1];
+}
+
+static int run(replay_t* rp, reader_t* r,
+               void (*callback)(const event_type ev, void* c_info,
+                                const void* in, const uint32_t len),
+               replay_mode mode, replay_stats* st) {
+  const uint64_t start = now_ns();
+  uint64_t offset = 0;
+
+  while (r->p < r->end) {
+    const uint8_t type = *r->p++;
+    uint64_t delta, id, len = 0;
+    const void* in = NULL;
+    if (type >= __EVT_MAX_COUNT || get_varint(r, &delta) == -1 ||
+        get_varint(r, &id) == -1) {
+      break;
+    }
+
+    void** slot = client_slot(rp, id);
+    if (!slot) {
+      return -1;
+    }
+
+    if (type == EVT_CLIENT_CONNECTED) {
+      uint64_t port;
+      char ip[16];
+      if (get_varint(r, &port) == -1 || r->p >= r->end ||
+          *r->p > 15 || r->end - r->p < 1 + *r->p) {
+        break;
+      }
+      const uint8_t ip_len = *r->p++;
+      memcpy(ip, r->p, ip_len);
+      ip[ip_len] = '\0';
+      r->p += ip_len;
+
+      client_destroy(*slot);
+      *slot = create_client(rp, ip, (uint16_t)port);
+      if (!*slot) {
+        return -1;
+      }
+      st->connections++;
+    } else if (type == EVT_CLIENT_DATA_RECEIVED) {
+      if (get_varint(r, &len) == -1 || (uint64_t)(r->end - r->p) < len) {
+        break;
+      }
+      in = r->p;
+      r->p += len;
+    }
+
+    // a capture cut off mid-connection may reference unknown clients
+    offset += delta;
+    if (!*slot) {
+      continue;
+    }
+    if (mode == REPLAY_REALTIME) {
+      const uint64_t due = start + offset;
+      struct timespec ts = {.tv_sec = due / 1000000000ull,
+                            .tv_nsec = due % 1000000000ull};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+             EINTR) {
+      }
+    }
+
+    const uint64_t t0 = now_ns();
+    callback((event_type)type, *slot, in, (uint32_t)len);
+    const uint64_t dur = now_ns() - t0;
+
+    st->events++;
+    st->handler_ns += dur;
+    if (type == EVT_CLIENT_DATA_RECEIVED) {
+      st->data_events++;
+      st->bytes += len;
+    }
+    record_latency(rp, dur);
+
+    // there is no peer, output is considered delivered
+    client_discard_output(*slot);
+    while (read(rp->sink[0], rp->scratch, sizeof(rp->scratch)) > 0) {
+    }
+
+    if (type == EVT_CLIENT_DISCONNECTED) {
+      client_destroy(*slot);
+      *slot = NULL;
+    }
+  }
+
+  st->elapsed_ns = now_ns() - start;
+  return 0;
+}
+
+int replay_run(const char* path,
+               void (*callback)(const event_type ev, void* c_info,
+                                const void* in, const uint32_t len),
+               replay_mode mode, replay_stats* out) {
+  replay_t* rp = NULL;
+  void* map = MAP_FAILED;
+  struct stat sb;
+  int result = -1;
+  int fd = -1;
+
+  if (!path || !callback || !out) {
+    LOG_ERR("replay_run err: invalid argument");
+    return -1;
+  }
+  memset(out, 0, sizeof(*out));
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1 || fstat(fd, &sb) == -1) {
+    LOG_ERRNO("replay_run err");
+    goto replay_err;
+  }
+
+  if (sb.st_size < HEADER_SIZE) {
+    LOG_ERR("replay_run err: capture too short");
+    goto replay_err;
+  }
+
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    LOG_ERRNO("replay_run err");
+    goto replay_err;
+  }
+  madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+  uint32_t version;
+  memcpy(&version, (const char*)map + 8, 4);
+  if (memcmp(map, CAPTURE_MAGIC, 8) != 0 || version != CAPTURE_VERSION) {
+    LOG_ERR("replay_run err: not a capture of version %u", CAPTURE_VERSION);
+    goto replay_err;
+  }
+
+  rp = (replay_t*)calloc(1, sizeof(replay_t));
+  if (!rp) {
+    LOG_ERR("cannot create replay state");
+    goto replay_err;
+  }
+  rp->sink[0] = rp->sink[1] = -1;
+
+  rp->efd = epoll_create1(EPOLL_CLOEXEC);
+  if (rp->efd == -1 ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0,
+                 rp->sink) == -1) {
+    LOG_ERRNO("replay_run err");
+    goto replay_err;
+  }
+
+  reader_t r = {.p = (const uint8_t*)map + HEADER_SIZE,
+                .end = (const uint8_t*)map + sb.st_size};
+  result = run(rp, &r, callback, mode, out);
+  finish_stats(rp, out);
+
+replay_err:
+  if (rp) {
+    uint32_t i = 0;
+    for (; i < rp->client_cap; ++i) {
+      client_destroy(rp->clients[i]);
+    }
+    free(rp->clients);
+    free(rp->latencies);
+    if (rp->sink[0] != -1) {
+      close(rp->sink[0]);
+      close(rp->sink[1]);
+    }
+    if (rp->efd != -1) {
+      close(rp->efd);
+    }
+    free(rp);
+  }
+  if (map != MAP_FAILED) {
+    munmap(map, sb.st_size);
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return result;
+}
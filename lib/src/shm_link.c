@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include "shm_link.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define SHM_MAGIC 0x53484d4c494e4b31ull  // "SHMLINK1"
+#define DATA_OFFSET 4096
+// the creator cannot resize the memfd under the mapping of the attacher
+#define SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+// producer and consumer fields live on separate cache lines
+typedef struct {
+  _Atomic uint64_t head;        // bytes ever produced
+  _Atomic uint32_t want_space;  // producer sleeps until tail moves
+  char pad0[52];
+  _Atomic uint64_t tail;        // bytes ever consumed
+  _Atomic uint32_t want_data;   // consumer sleeps until head moves
+  char pad1[52];
+} ring_ctl_t;
+
+typedef struct {
+  uint64_t magic;
+  uint32_t ring_size;
+  uint32_t reserved;
+  char pad[48];
+  ring_ctl_t ring[2];  // 0 flows from the creator to the attacher
+} shm_header_t;
+
+typedef struct {
+  ring_ctl_t* ctl;
+  char* data;
+} ring_t;
+
+typedef struct {
+  shm_header_t* hdr;
+  size_t map_size;
+  uint32_t size;
+  ring_t tx;
+  ring_t rx;
+  int memfd;
+  int bell;       // this side sleeps on it
+  int peer_bell;  // the other side sleeps on it
+} shm_link_t;
+
+static inline int valid_ring_size(uint32_t size) {
+  return size >= 4096 && !(size & (size - 1));
+}
+
+static void ring(int fd) {
+  const uint64_t one = 1;
+  if (write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+    LOG_ERRNO("shm_link doorbell err");
+  }
+}
+
+static int map(shm_link_t* l, int creator) {
+  l->hdr = (shm_header_t*)mmap(NULL, l->map_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, l->memfd, 0);
+  if (l->hdr == MAP_FAILED) {
+    l->hdr = NULL;
+    LOG_ERRNO("shm_link mmap err");
+    return -1;
+  }
+
+  char* data = (char*)l->hdr + DATA_OFFSET;
+  const int tx = creator ? 0 : 1;
+  l->tx.ctl = &l->hdr->ring[tx];
+  l->tx.data = data + (size_t)tx * l->size;
+  l->rx.ctl = &l->hdr->ring[!tx];
+  l->rx.data = data + (size_t)!tx * l->size;
+  return 0;
+}
+
+void* shm_link_create(uint32_t ring_size, int fds[SHM_LINK_FDS]) {
+  shm_link_t* l = NULL;
+
+  // the ring index math wants a power of two
+  if (!valid_ring_size(ring_size)) {
+    LOG_ERR("shm_link_create err: invalid ring size %u", ring_size);
+    goto create_err;
+  }
+
+  l = (shm_link_t*)calloc(1, sizeof(shm_link_t));
+  if (!l) {
+    LOG_ERR("cannot create shm link");
+    goto create_err;
+  }
+  l->memfd = l->bell = l->peer_bell = -1;
+  l->size = ring_size;
+  l->map_size = DATA_OFFSET + 2 * (size_t)ring_size;
+
+  l->memfd = memfd_create("socev-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (l->memfd == -1 || ftruncate(l->memfd, l->map_size) == -1 ||
+      fcntl(l->memfd, F_ADD_SEALS, SHM_SEALS) == -1) {
+    LOG_ERRNO("shm_link_create err");
+    goto create_err;
+  }
+
+  l->bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  l->peer_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (l->bell == -1 || l->peer_bell == -1) {
+    LOG_ERRNO("shm_link_create err");
+    goto create_err;
+  }
+
+  if (map(l, 1) == -1) {
+    goto create_err;
+  }
+  l->hdr->ring_size = ring_size;
+  l->hdr->magic = SHM_MAGIC;
+
+  // the attacher sleeps on what is the peer bell here
+  fds[0] = l->memfd;
+  fds[1] = l->peer_bell;
+  fds[2] = l->bell;
+  return l;
+
+create_err:
+  shm_link_destroy(l);
+  return NULL;
+}
+
+void* shm_link_attach(const int fds[SHM_LINK_FDS]) {
+  shm_link_t* l = (shm_link_t*)calloc(1, sizeof(shm_link_t));
+  if (!l) {
+    LOG_ERR("cannot create shm link");
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    return NULL;
+  }
+
+  l->memfd = fds[0];
+  l->bell = fds[1];
+  l->peer_bell = fds[2];
+
+  // everything in the header comes from the peer, the mapping must cover
+  // the rings it describes and stay that size
+  shm_header_t hdr;
+  struct stat st;
+  if (pread(l->memfd, &hdr, sizeof(hdr.magic) + sizeof(hdr.ring_size), 0) !=
+          sizeof(hdr.magic) + sizeof(hdr.ring_size) ||
+      hdr.magic != SHM_MAGIC || !valid_ring_size(hdr.ring_size)) {
+    LOG_ERR("shm_link_attach err: not a socev shm link");
+    goto attach_err;
+  }
+  l->size = hdr.ring_size;
+  l->map_size = DATA_OFFSET + 2 * (size_t)l->size;
+
+  // files that cannot be sealed fail F_GET_SEALS, -1 has every seal bit set
+  const int seals = fcntl(l->memfd, F_GET_SEALS);
+  if (fstat(l->memfd, &st) == -1 || (size_t)st.st_size < l->map_size ||
+      seals == -1 || (seals & SHM_SEALS) != SHM_SEALS) {
+    LOG_ERR("shm_link_attach err: memfd too small or not sealed");
+    goto attach_err;
+  }
+
+  if (map(l, 0) == -1) {
+    goto attach_err;
+  }
+
+  return l;
+
+attach_err:
+  shm_link_destroy(l);
+  return NULL;
+}
+
+void shm_link_destroy(void* link) {
+  if (link) {
+    shm_link_t* l = (shm_link_t*)link;
+    if (l->hdr) {
+      munmap(l->hdr, l->map_size);
+    }
+    if (l->memfd != -1) {
+      close(l->memfd);
+    }
+    if (l->bell != -1) {
+      close(l->bell);
+    }
+    if (l->peer_bell != -1) {
+      close(l->peer_bell);
+    }
+    free(l);
+  }
+}
+
+int shm_link_get_doorbell(void* link) {
+  shm_link_t* l = (shm_link_t*)link;
+  return l ? l->bell : -1;
+}
+
+void shm_link_ack_doorbell(void* link) {
+  shm_link_t* l = (shm_link_t*)link;
+  uint64_t value;
+  if (read(l->bell, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+    LOG_ERRNO("shm_link doorbell err");
+  }
+}
+
+uint32_t shm_link_write(void* link, const void* data, uint32_t len) {
+  shm_link_t* l = (shm_link_t*)link;
+  ring_ctl_t* ctl = l->tx.ctl;
+
+  const uint64_t head = atomic_load_explicit(&ctl->head, memory_order_relaxed);
+  const uint64_t tail = atomic_load_explicit(&ctl->tail, memory_order_acquire);
+  // the peer writes tail, a bogus one must not move memcpy past the ring
+  const uint64_t used = head - tail < l->size ? head - tail : l->size;
+  const uint32_t free_bytes = l->size - (uint32_t)used;
+  const uint32_t n = len < free_bytes ? len : free_bytes;
+  if (!n) {
+    return 0;
+  }
+
+  const uint32_t pos = (uint32_t)head & (l->size - 1);
+  const uint32_t first = l->size - pos < n ? l->size - pos : n;
+  memcpy(l->tx.data + pos, data, first);
+  memcpy(l->tx.data, (const char*)data + first, n - first);
+
+  atomic_store_explicit(&ctl->head, head + n, memory_order_release);
+
+  // pairs with the fence in shm_link_arm_read: either the consumer sees the
+  // new head or this side sees its request for a doorbell
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ctl->want_data, memory_order_relaxed) &&
+      atomic_exchange_explicit(&ctl->want_data, 0, memory_order_relaxed)) {
+    ring(l->peer_bell);
+  }
+
+  return n;
+}
+
+uint32_t shm_link_peek(void* link, const void** data) {
+  shm_link_t* l = (shm_link_t*)link;
+  ring_ctl_t* ctl = l->rx.ctl;
+
+  const uint64_t tail = atomic_load_explicit(&ctl->tail, memory_order_relaxed);
+  const uint64_t head = atomic_load_explicit(&ctl->head, memory_order_acquire);
+  const uint32_t avail =
+      head - tail < l->size ? (uint32_t)(head - tail) : l->size;
+  const uint32_t pos = (uint32_t)tail & (l->size - 1);
+
+  *data = l->rx.data + pos;
+  return l->size - pos < avail ? l->size - pos : avail;
+}
+
+void shm_link_consume(void* link, uint32_t len) {
+  shm_link_t* l = (shm_link_t*)link;
+  ring_ctl_t* ctl = l->rx.ctl;
+
+  const uint64_t tail = atomic_load_explicit(&ctl->tail, memory_order_relaxed);
+  atomic_store_explicit(&ctl->tail, tail + len, memory_order_release);
+
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ctl->want_space, memory_order_relaxed) &&
+      atomic_exchange_explicit(&ctl->want_space, 0, memory_order_relaxed)) {
+    ring(l->peer_bell);
+  }
+}
+
+int shm_link_has_space(void* link) {
+  shm_link_t* l = (shm_link_t*)link;
+  ring_ctl_t* ctl = l->tx.ctl;
+  const uint64_t head = atomic_load_explicit(&ctl->head, memory_order_relaxed);
+  const uint64_t tail = atomic_load_explicit(&ctl->tail, memory_order_acquire);
+  return head - tail < l->size;
+}
+
+int shm_link_arm_read(void* link) {
+  shm_link_t* l = (shm_link_t*)link;
+  ring_ctl_t* ctl = l->rx.ctl;
+
+  atomic_store_explicit(&ctl->want_data, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  const uint64_t tail = atomic_load_explicit(&ctl->tail, memory_order_relaxed);
+  if (atomic_load_explicit(&ctl->head, memory_order_relaxed) != tail) {
+    atomic_store_explicit(&ctl->want_data, 0, memory_order_relaxed);
+    return 1;
+  }
+  return 0;
+}
+
+int shm_link_arm_write(void* link) {
+  shm_link_t* l = (shm_link_t*)link;
+  ring_ctl_t* ctl = l->tx.ctl;
+
+  atomic_store_explicit(&ctl->want_space, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (shm_link_has_space(link)) {
+    atomic_store_explicit(&ctl->want_space, 0, memory_order_relaxed);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include "task_queue.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#include "log.h"
+
+typedef struct {
+  task_fn fn;
+  void* arg;
+} task_t;
+
+typedef struct {
+  task_t* tasks;
+  uint32_t cap;
+  uint32_t head;
+  uint32_t cnt;
+} task_queue_t;
+
+void* task_queue_create(uint32_t capacity) {
+  task_queue_t* q = (task_queue_t*)calloc(1, sizeof(task_queue_t));
+  if (!q) {
+    LOG_ERR("cannot create task queue");
+    goto create_err;
+  }
+
+  q->cap = capacity ? capacity : 16;
+  q->tasks = (task_t*)malloc(q->cap * sizeof(task_t));
+  if (!q->tasks) {
+    LOG_ERR("cannot create task queue");
+    goto create_err;
+  }
+
+  return q;
+
+create_err:
+  task_queue_destroy(q);
+  return NULL;
+}
+
+void task_queue_destroy(void* queue) {
+  if (queue) {
+    task_queue_t* q = (task_queue_t*)queue;
+    free(q->tasks);
+    free(q);
+  }
+}
+
+uint32_t task_queue_count(void* queue) {
+  if (queue) {
+    task_queue_t* q = (task_queue_t*)queue;
+    return q->cnt;
+  }
+
+  return 0;
+}
+
+// unwraps the ring into a buffer twice as large
+static int grow(task_queue_t* q) {
+  const uint32_t cap = q->cap * 2;
+  task_t* tasks = (task_t*)malloc(cap * sizeof(task_t));
+  if (!tasks) {
+    LOG_ERR("cannot grow task queue to %u entries", cap);
+    return -1;
+  }
+
+  const uint32_t first = q->cap - q->head < q->cnt ? q->cap - q->head : q->cnt;
+  memcpy(tasks, q->tasks + q->head, first * sizeof(task_t));
+  memcpy(tasks + first, q->tasks, (q->cnt - first) * sizeof(task_t));
+
+  free(q->tasks);
+  q->tasks = tasks;
+  q->cap = cap;
+  q->head = 0;
+  return 0;
+}
+
+int task_queue_push(void* queue, task_fn fn, void* arg) {
+  if (!queue || !fn) {
+    LOG_ERR("task_queue_push err: invalid argument");
+    return -1;
+  }
+
+  task_queue_t* q = (task_queue_t*)queue;
+  if (q->cnt == q->cap && grow(q) == -1) {
+    return -1;
+  }
+
+  task_t* t = &q->tasks[(q->head + q->cnt) % q->cap];
+  t->fn = fn;
+  t->arg = arg;
+  q->cnt++;
+  return 0;
+}
+
+int task_queue_pop(void* queue, task_fn* fn, void** arg) {
+  task_queue_t* q = (task_queue_t*)queue;
+  if (!q || !q->cnt) {
+    return -1;
+  }
+
+  *fn = q->tasks[q->head].fn;
+  *arg = q->tasks[q->head].arg;
+  q->head = (q->head + 1) % q->cap;
+  q->cnt--;
+  return 0;
+}
@@ -1,22 +1,52 @@
+#define _GNU_SOURCE
 #include "tcp_context.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <malloc.h>
 #include <poll.h>
-#include <stdio.h>
+#include <sched.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "capture.h"
 #include "client.h"
 #include "client_list.h"
 #include "epoll_helper.h"
+#include "group.h"
+#include "log.h"
+#include "payload.h"
+#include "proxy.h"
+#include "shm_link.h"
+#include "task_queue.h"
+#include "tls.h"
+#include "trace.h"
 #include "utils.h"
+#include "watcher.h"
 
 #define INTERNAL_BUFFER_SIZE (64 * 1024)
+#define DEFAULT_SHM_RING_SIZE (1024 * 1024)
+#define HANDSHAKE_TIMEOUT_US (10 * 1000 * 1000)
+#define SHM_HELLO_TIMEOUT_US (1000 * 1000)
+
+// a local connection waits for its link on the socket, then the socket only
+// tells when the peer is gone and the doorbell when to look at the rings
+typedef struct {
+  void* ctx;
+  int fd;
+  void* client;    // NULL until the peer sent its link
+  void* watcher;   // on the socket while pending, on the doorbell after
+  int timer_fd;    // bounds the wait for the link, -1 once linked
+  void* timer;
+  int announce;    // EVT_CLIENT_CONNECTED is still due
+  int wait_space;  // the peer rings once it consumed from a full ring
+  uint64_t active_ns;
+} shm_peer_t;
 
 typedef struct {
   int fd;
@@ -26,46 +56,170 @@ typedef struct {
                    const unsigned int len);
   void* client_list;
   struct epoll_event* events;
+  size_t max_events;
+  uint32_t options;
+  int cpu;
+  tcp_context_stats stats;
+  void* trace;       // recording ring, NULL while tracing is disabled
+  void* trace_ring;  // kept allocated across disable/enable
+  volatile sig_atomic_t trace_dump_requested;
+  const char* trace_dump_path;
+  void** groups;
+  uint32_t group_cnt;
+  uint32_t group_cap;
+  uint64_t max_queued_bytes;
+  void* next_tick;  // tasks run after the i/o callbacks
+  void* idle;       // tasks run when epoll_wait found nothing to do
+  uint64_t task_budget_ns;
+  void** watchers;
+  uint32_t watcher_cnt;
+  uint32_t watcher_cap;
+  int watchers_stopped;  // some watchers wait to be released
+  void* tls_config;      // NULL unless accepted connections speak tls
+  void* capture;         // NULL unless events are being captured
+  uint32_t zerocopy_threshold;
+  int shm_fd;  // unix listener for shared memory links, -1 if none
+  char* shm_path;
+  uint32_t shm_ring_size;
+  uint64_t shm_poll_ns;
+  shm_peer_t** shm_peers;
+  uint32_t shm_cnt;
+  uint32_t shm_cap;
+  uint32_t shm_pending;  // peers that did not send their link yet
+  int shm_busy;  // some link needs another pass before the loop may sleep
+  void* user;
 } tcp_context;
 
+static int listen_shm(tcp_context* ctx, const char* path, int backlog);
+
+static inline uint64_t trace_begin(tcp_context* ctx) {
+  return ctx->trace ? trace_now() : 0;
+}
+
+static inline void trace_end(tcp_context* ctx, uint16_t type, int fd,
+                             uint64_t start_ns, uint16_t arg) {
+  if (ctx->trace) {
+    trace_record(ctx->trace, type, fd, start_ns, arg);
+  }
+}
+
+// clients that connected before the capture started are introduced by a
+// synthetic connect record
+static void capture_event(tcp_context* ctx, const event_type ev, void* client,
+                          const void* in, const uint32_t len) {
+  uint32_t id = client_get_capture_id(client);
+
+  if (id < capture_get_base_id(ctx->capture)) {
+    id = capture_connect(ctx->capture, client_get_ip(client),
+                         client_get_port(client));
+    client_set_capture_id(client, id);
+    if (ev == EVT_CLIENT_CONNECTED) {
+      return;
+    }
+  }
+
+  capture_record(ctx->capture, ev, id, in, len);
+}
+
+static void notify(tcp_context* ctx, const event_type ev, void* client,
+                   const void* in, const uint32_t len) {
+  if (ctx->capture) {
+    capture_event(ctx, ev, client, in, len);
+  }
+
+  if (ctx->callback) {
+    const int fd = client_get_fd(client);
+    const uint64_t start = trace_begin(ctx);
+    ctx->callback(ev, client, in, len);
+    trace_end(ctx, TRACE_CALLBACK, fd, start, ev);
+  }
+}
+
 void* tcp_context_create(tcp_context_params params) {
   tcp_context* ctx = (tcp_context*)calloc(1, sizeof(tcp_context));
 
   if (!ctx) {
-    fprintf(stderr, "tcp_context_create err: cannot create context\n");
+    LOG_ERR("tcp_context_create err: cannot create context");
     goto create_error;
   }
 
-  ctx->recv_buf = (char*)calloc(1, INTERNAL_BUFFER_SIZE);
+  ctx->fd = -1;
+  ctx->efd = -1;
+  ctx->shm_fd = -1;
+  ctx->options = params.options;
+  ctx->cpu = -1;
+
+  // pin before allocating so that the per-loop buffers are numa-local
+  if (params.options & OPT_PIN_CPU) {
+    if (pin_thread_to_cpu(params.cpu) == -1) {
+      goto create_error;
+    }
+    ctx->cpu = params.cpu;
+  } else if (params.options & OPT_STEER_INCOMING_CPU) {
+    ctx->cpu = params.cpu;
+  }
+  ctx->stats.cpu = ctx->cpu;
+
+  ctx->recv_buf = (char*)alloc_local(INTERNAL_BUFFER_SIZE);
   if (!ctx->recv_buf) {
-    fprintf(stderr, "tcp_context_create err: %s\n", strerror(errno));
+    LOG_ERR("tcp_context_create err: cannot create receive buffer");
     goto create_error;
   }
 
   ctx->efd = epoll_create1(0);
   if (ctx->efd == -1) {
-    fprintf(stderr, "epoll_create: %s\n", strerror(errno));
+    LOG_ERRNO("epoll_create");
     goto create_error;
   }
 
   ctx->client_list = client_list_create(params.max_client_count);
   if (!ctx->client_list) {
-    fprintf(stderr, "tcp_context_create err: cannot create client list\n");
+    LOG_ERR("tcp_context_create err: cannot create client list");
     goto create_error;
   }
 
-  ctx->events =
-      calloc(params.max_client_count * 2 + 1, sizeof(struct epoll_event));
+  ctx->max_events = params.max_client_count * 2 + 1;
+  ctx->events = (struct epoll_event*)alloc_local(ctx->max_events *
+                                                 sizeof(struct epoll_event));
   if (!ctx->events) {
-    fprintf(stderr, "tcp_context_create err: cannot create event list\n");
+    LOG_ERR("tcp_context_create err: cannot create event list");
+    goto create_error;
+  }
+
+  ctx->next_tick = task_queue_create(0);
+  ctx->idle = task_queue_create(0);
+  if (!ctx->next_tick || !ctx->idle) {
+    LOG_ERR("tcp_context_create err: cannot create task queues");
     goto create_error;
   }
 
+  if (params.tls_cert_file) {
+    ctx->tls_config =
+        tls_config_create(params.tls_cert_file, params.tls_key_file,
+                          !(params.options & OPT_TLS_NO_KTLS));
+    if (!ctx->tls_config) {
+      goto create_error;
+    }
+  }
+
   ctx->callback = params.callback;
+  ctx->max_queued_bytes = params.max_queued_bytes;
+  ctx->task_budget_ns = params.task_budget_us * 1000;
+  ctx->zerocopy_threshold = params.zerocopy_threshold;
+  ctx->shm_ring_size =
+      params.shm_ring_size ? params.shm_ring_size : DEFAULT_SHM_RING_SIZE;
+  ctx->shm_poll_ns = (uint64_t)params.shm_poll_us * 1000;
+  ctx->user = params.user;
 
-  ctx->fd = create_listener_socket(params.port);
+  ctx->fd = create_listener_socket(
+      params.port, (params.options & OPT_STEER_INCOMING_CPU) != 0);
   if (ctx->fd == -1) {
-    fprintf(stderr, "socket create failed\n");
+    LOG_ERR("socket create failed");
+    goto create_error;
+  }
+
+  if ((params.options & OPT_STEER_INCOMING_CPU) &&
+      set_socket_incoming_cpu(ctx->fd, params.cpu) == -1) {
     goto create_error;
   }
 
@@ -75,7 +229,12 @@ void* tcp_context_create(tcp_context_params params) {
 
   // start listening incoming connections
   if (listen(ctx->fd, params.max_client_count) == -1) {
-    fprintf(stderr, "tcp_context_create err: %s\n", strerror(errno));
+    LOG_ERRNO("tcp_context_create err");
+    goto create_error;
+  }
+
+  if (params.shm_path && listen_shm(ctx, params.shm_path,
+                                    params.max_client_count) == -1) {
     goto create_error;
   }
 
@@ -87,29 +246,67 @@ create_error:
 }
 
 void tcp_context_destroy(void* tcp_ctx) {
-  if (!tcp_ctx) {
+  if (tcp_ctx) {
     tcp_context* ctx = (tcp_context*)(tcp_ctx);
+    uint32_t i = 0;
+
+    // doorbells close with their clients, stop watching them before
+    for (; i < ctx->shm_cnt; ++i) {
+      watcher_stop(ctx->shm_peers[i]->watcher);
+      watcher_stop(ctx->shm_peers[i]->timer);
+      if (!ctx->shm_peers[i]->client) {
+        close(ctx->shm_peers[i]->fd);
+      }
+      if (ctx->shm_peers[i]->timer_fd != -1) {
+        close(ctx->shm_peers[i]->timer_fd);
+      }
+      free(ctx->shm_peers[i]);
+    }
+    free(ctx->shm_peers);
+
+    // clients and watchers unregister from the epoll instance, release them
+    // first
+    client_list_destroy(ctx->client_list);
+
+    for (i = 0; i < ctx->watcher_cnt; ++i) {
+      watcher_destroy(ctx->watchers[i]);
+    }
+    free(ctx->watchers);
 
     // close listening socket
     if (ctx->fd != -1) {
       close(ctx->fd);
     }
 
+    if (ctx->shm_fd != -1) {
+      close(ctx->shm_fd);
+      unlink(ctx->shm_path);
+    }
+    free(ctx->shm_path);
+
     if (ctx->efd != -1) {
       close(ctx->efd);
     }
 
     // free receive buffer
-    if (ctx->recv_buf) {
-      free(ctx->recv_buf);
-    }
+    free_local(ctx->recv_buf, INTERNAL_BUFFER_SIZE);
 
     // free event list
-    if (ctx->events) {
-      free(ctx->events);
+    free_local(ctx->events, ctx->max_events * sizeof(struct epoll_event));
+
+    for (i = 0; i < ctx->group_cnt; ++i) {
+      group_destroy(ctx->groups[i]);
     }
+    free(ctx->groups);
 
-    client_list_destroy(ctx->client_list);
+    trace_destroy(ctx->trace_ring);
+
+    task_queue_destroy(ctx->next_tick);
+    task_queue_destroy(ctx->idle);
+
+    tls_config_destroy(ctx->tls_config);
+
+    capture_destroy(ctx->capture);
 
     // release tcp context
     free(ctx);
@@ -117,18 +314,67 @@ void tcp_context_destroy(void* tcp_ctx) {
   }
 }
 
+static void update_locality_stats(tcp_context* ctx, int fd) {
+  const int loop_cpu = ctx->cpu != -1 ? ctx->cpu : sched_getcpu();
+  const int flow_cpu = get_socket_incoming_cpu(fd);
+
+  ctx->stats.flows++;
+  if (flow_cpu == -1 || loop_cpu == -1) {
+    return;
+  }
+
+  if (flow_cpu == loop_cpu) {
+    ctx->stats.flows_local++;
+  } else {
+    ctx->stats.flows_remote++;
+  }
+}
+
+// the handshake runs on the readiness the library asks for, the callback
+// only learns about the client once it is established
+static void do_handshake(tcp_context* ctx, void* client) {
+  void* tls = client_get_tls(client);
+  const int state = tls_handshake(tls);
+
+  if (state == -1) {
+    client_list_del_client(ctx->client_list, client_get_fd(client));
+    return;
+  }
+
+  if (state != TLS_DONE) {
+    client_set_interest(client, state == TLS_WANT_READ,
+                        state == TLS_WANT_WRITE);
+    return;
+  }
+
+  ctx->stats.tls_handshakes++;
+  if (tls_ktls_send(tls)) {
+    ctx->stats.tls_ktls_send++;
+  }
+  if (tls_ktls_recv(tls)) {
+    ctx->stats.tls_ktls_recv++;
+  }
+
+  client_set_deadline(client, 0);
+  client_set_interest(client, 1, 0);
+  notify(ctx, EVT_CLIENT_CONNECTED, client, NULL, 0);
+}
+
 int do_accept(tcp_context* ctx) {
   struct sockaddr_in client_addr;
   memset(&client_addr, 0, sizeof(struct sockaddr_in));
   socklen_t size = sizeof(struct sockaddr_in);
 
+  const uint64_t start = trace_begin(ctx);
   int new_fd = accept(ctx->fd, (struct sockaddr*)(&client_addr), &size);
+  trace_end(ctx, TRACE_ACCEPT, new_fd, start, 0);
   if (new_fd == -1) {
-    fprintf(stderr, "do_accept err: %s\n", strerror(errno));
+    LOG_ERRNO("do_accept err");
     return -1;
   }
 
   if (set_socket_nonblocking(new_fd) == -1) {
+    close(new_fd);
     return -1;
   }
 
@@ -136,110 +382,1246 @@ int do_accept(tcp_context* ctx) {
       ctx->efd, new_fd, inet_ntoa(client_addr.sin_addr), client_addr.sin_port);
 
   if (!client) {
-    fprintf(stderr, "cannot create new client");
+    LOG_ERR("cannot create new client");
     return -1;
   }
 
   if (client_list_add_client(ctx->client_list, client) == -1) {
+    client_destroy(client);
     return -1;
   }
 
-  if (ctx->callback) {
-    ctx->callback(EVT_CLIENT_CONNECTED, client, NULL, 0);
+  // only flows that became clients are counted
+  update_locality_stats(ctx, new_fd);
+  client_set_context(client, ctx);
+  if (ctx->zerocopy_threshold) {
+    client_set_zerocopy_threshold(client, ctx->zerocopy_threshold);
+  }
+
+  if (ctx->tls_config) {
+    void* tls = tls_create(ctx->tls_config, new_fd);
+    if (!tls) {
+      client_list_del_client(ctx->client_list, new_fd);
+      return -1;
+    }
+    client_set_tls(client, tls);
+    // a peer that stalls its handshake is dropped once the timer fires
+    client_set_deadline(client, HANDSHAKE_TIMEOUT_US);
+    do_handshake(ctx, client);
+    return new_fd;
   }
 
+  notify(ctx, EVT_CLIENT_CONNECTED, client, NULL, 0);
+
   return new_fd;
 }
 
+// records decrypted ahead of the socket are not signalled by epoll, they are
+// drained here
+static int do_receive_tls(tcp_context* ctx, void* client) {
+  void* tls = client_get_tls(client);
+  const int fd = client_get_fd(client);
+
+  do {
+    const uint64_t start = trace_begin(ctx);
+    ssize_t bytes = tls_read(tls, ctx->recv_buf, INTERNAL_BUFFER_SIZE);
+    trace_end(ctx, TRACE_RECV, fd, start, 0);
+    if (bytes == -1) {
+      if (errno == EAGAIN) {
+        return 0;
+      }
+      LOG_ERRNO("do_receive err");
+      return -1;
+    }
+
+    if (bytes == 0) {
+      return -2;
+    }
+
+    if (!client_is_closing(client)) {
+      notify(ctx, EVT_CLIENT_DATA_RECEIVED, client, ctx->recv_buf, bytes);
+    }
+  } while (tls_pending(tls) > 0);
+
+  return 0;
+}
+
+// delivers what the ring holds straight from the shared mapping, bounded
+// so that a fast producer cannot keep the loop here
+static uint32_t drain_shm(tcp_context* ctx, void* client) {
+  void* link = client_get_shm(client);
+  const int fd = client_get_fd(client);
+  uint32_t total = 0;
+  const void* data;
+  uint32_t bytes;
+
+  while (total < ctx->shm_ring_size &&
+         (bytes = shm_link_peek(link, &data)) > 0) {
+    const uint64_t start = trace_begin(ctx);
+    if (!client_is_closing(client)) {
+      notify(ctx, EVT_CLIENT_DATA_RECEIVED, client, data, bytes);
+    }
+    shm_link_consume(link, bytes);
+    trace_end(ctx, TRACE_RECV, fd, start, 1);
+    total += bytes;
+  }
+
+  return total;
+}
+
+// nothing but the end of the stream is expected on the socket of a link,
+// the peer may have filled the ring right before it left
+static int do_receive_shm(tcp_context* ctx, void* client) {
+  ssize_t bytes = recv(client_get_fd(client), ctx->recv_buf, 1, 0);
+  if (bytes == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    LOG_ERRNO("do_receive err");
+    return -1;
+  }
+
+  if (bytes == 0) {
+    drain_shm(ctx, client);
+    return -2;
+  }
+
+  return 0;
+}
+
 int do_receive(tcp_context* ctx, void* client) {
+  // a tls read may have to wait for the socket to become writable
+  if (client_get_tls(client)) {
+    const int result = do_receive_tls(ctx, client);
+    client_update_interest(client);
+    return result;
+  }
+
+  if (client_get_shm(client)) {
+    return do_receive_shm(ctx, client);
+  }
+
   int fd = client_get_fd(client);
+  const uint64_t start = trace_begin(ctx);
   ssize_t bytes = recv(fd, ctx->recv_buf, INTERNAL_BUFFER_SIZE, 0);
+  trace_end(ctx, TRACE_RECV, fd, start, 0);
   if (bytes == -1) {
-    fprintf(stderr, "do_receive err: %s\n", strerror(errno));
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    }
+    LOG_ERRNO("do_receive err");
     return -1;
   }
 
   // client disconnected
   if (bytes == 0) {
-    if (ctx->callback) {
-      ctx->callback(EVT_CLIENT_DISCONNECTED, client, NULL, 0);
-    }
-
     return -2;
   }
 
+  // input arriving after client_close is dropped
+  if (client_is_closing(client)) {
+    return 0;
+  }
+
   // client data received
-  if (ctx->callback) {
-    ctx->callback(EVT_CLIENT_DATA_RECEIVED, client, ctx->recv_buf, bytes);
+  notify(ctx, EVT_CLIENT_DATA_RECEIVED, client, ctx->recv_buf, bytes);
+
+  return 0;
+}
+
+// hands completed zero-copy buffers back, all of them when force is set
+static void release_zerocopy(tcp_context* ctx, void* client, int force) {
+  const void* data;
+  uint32_t len;
+
+  while (client_pop_zerocopy_done(client, force, &data, &len) == 0) {
+    notify(ctx, EVT_CLIENT_SEND_COMPLETE, client, data, len);
+  }
+}
+
+static void do_zerocopy_completions(tcp_context* ctx, void* client) {
+  uint32_t copied = 0;
+  const int reports = client_read_zerocopy_completions(client, &copied);
+  if (reports > 0) {
+    ctx->stats.zerocopy_reports += reports;
+    ctx->stats.zerocopy_copied += copied;
+  }
+
+  release_zerocopy(ctx, client, 0);
+}
+
+static void stop_shm_timer(tcp_context* ctx, shm_peer_t* p) {
+  if (p->timer_fd != -1) {
+    tcp_context_unwatch(ctx, p->timer);
+    close(p->timer_fd);
+    p->timer_fd = -1;
+    p->timer = NULL;
+    ctx->shm_pending--;
+  }
+}
+
+static void drop_shm_peer(tcp_context* ctx, shm_peer_t* p) {
+  uint32_t i = 0;
+  stop_shm_timer(ctx, p);
+  for (; i < ctx->shm_cnt; ++i) {
+    if (ctx->shm_peers[i] == p) {
+      ctx->shm_peers[i] = ctx->shm_peers[--ctx->shm_cnt];
+      break;
+    }
+  }
+  free(p);
+}
+
+static void del_shm_peer(tcp_context* ctx, void* client) {
+  uint32_t i = 0;
+  for (; i < ctx->shm_cnt; ++i) {
+    shm_peer_t* p = ctx->shm_peers[i];
+    if (p->client == client) {
+      tcp_context_unwatch(ctx, p->watcher);
+      drop_shm_peer(ctx, p);
+      return;
+    }
+  }
+}
+
+static void remove_client(tcp_context* ctx, void* client) {
+  void* proxy = client_get_proxy(client);
+  void* peer = NULL;
+
+  // the application gets every buffer back before the disconnect, data still
+  // in flight keeps its own page references inside the kernel
+  release_zerocopy(ctx, client, 1);
+
+  // the doorbell goes away with the link
+  if (client_get_shm(client)) {
+    del_shm_peer(ctx, client);
+  }
+
+  if (proxy) {
+    peer = proxy_get_peer(proxy, client);
+    client_set_proxy(client, NULL);
+    client_set_proxy(peer, NULL);
+    proxy_destroy(proxy);
+  }
+
+  notify(ctx, EVT_CLIENT_DISCONNECTED, client, NULL, 0);
+  client_list_del_client(ctx->client_list, client_get_fd(client));
+
+  // the two sides of a proxy pair are closed together
+  if (peer) {
+    remove_client(ctx, peer);
+  }
+}
+
+static void do_proxy(tcp_context* ctx, void* client) {
+  if (proxy_pump(client_get_proxy(client)) != 0) {
+    remove_client(ctx, client);
+  }
+}
+
+static void do_connect(tcp_context* ctx, void* client) {
+  int err = 0;
+  socklen_t len = sizeof(err);
+
+  if (getsockopt(client_get_fd(client), SOL_SOCKET, SO_ERROR, &err, &len) ==
+          -1 ||
+      err != 0) {
+    SOCEV_LOG(LOG_LEVEL_ERROR, err ? err : errno, "do_connect err");
+    remove_client(ctx, client);
+    return;
+  }
+
+  client_set_connecting(client, 0);
+  notify(ctx, EVT_CLIENT_CONNECTED, client, NULL, 0);
+
+  if (client_get_proxy(client)) {
+    do_proxy(ctx, client);
+  }
+}
+
+// a member whose queue stays above the limit is either dropped or skipped by
+// broadcasts until it drains
+static void check_slow(tcp_context* ctx, void* client) {
+  if (!ctx->max_queued_bytes) {
+    return;
+  }
+
+  const uint64_t queued = client_get_queued_bytes(client);
+  if (queued <= ctx->max_queued_bytes) {
+    client_set_slow(client, 0);
+    return;
+  }
+
+  if (client_is_slow(client) || client_is_closing(client)) {
+    return;
+  }
+
+  client_set_slow(client, 1);
+  notify(ctx, EVT_CLIENT_SLOW, client, NULL, 0);
+
+  if (ctx->options & OPT_DROP_SLOW_CLIENTS) {
+    client_discard_output(client);
+    client_close(client);
+  }
+}
+
+// library deadlines bound handshakes and graceful closes
+static void do_deadline(tcp_context* ctx, void* client) {
+  client_set_deadline(client, 0);
+
+  // a closing client whose peer stopped reading is dropped
+  if (client_is_closing(client)) {
+    client_discard_output(client);
+    remove_client(ctx, client);
+    return;
+  }
+
+  // the callback never learned about a client stuck in its handshake
+  if (client_get_tls(client) && !tls_is_established(client_get_tls(client))) {
+    client_list_del_client(ctx->client_list, client_get_fd(client));
+  }
+}
+
+// returns 1 when the client is gone, a closing client is reaped once
+// everything is on the wire
+static int flush_client(tcp_context* ctx, void* client) {
+  const int result = client_flush(client);
+  if (result == -1) {
+    client_discard_output(client);
+    client_close(client);
+  } else {
+    check_slow(ctx, client);
+  }
+
+  if (client_is_closing(client) && !client_has_pending_output(client)) {
+    remove_client(ctx, client);
+    return 1;
   }
 
   return 0;
 }
 
-int tcp_context_service(void* tcp_ctx, int timeout_ms) {
-  int nfds, i, fd;
-  client_get_result_t get_res;
+static void flush_member(void* client, void* arg) {
+  flush_client((tcp_context*)arg, client);
+}
 
-  if (!tcp_ctx) {
-    return -1;
+// writes queued by broadcasts are batched and pushed once per iteration
+static void flush_groups(tcp_context* ctx) {
+  uint32_t i = 0;
+  for (; i < ctx->group_cnt; ++i) {
+    if (group_is_dirty(ctx->groups[i])) {
+      group_set_dirty(ctx->groups[i], 0);
+      group_foreach(ctx->groups[i], flush_member, ctx);
+    }
   }
+}
 
-  tcp_context* ctx = (tcp_context*)(tcp_ctx);
-  const size_t fd_cnt = client_list_get_max_count(ctx->client_list) * 2 + 1;
+static void do_writable(tcp_context* ctx, void* client) {
+  if (client_has_pending_output(client)) {
+    if (flush_client(ctx, client) || client_has_pending_output(client)) {
+      return;
+    }
+  }
 
-  nfds = epoll_wait(ctx->efd, ctx->events, fd_cnt, timeout_ms);
+  if (client_wants_writable(client)) {
+    // clear pollout request of the client
+    client_clear_callback_on_writable(client);
 
-  if (nfds == -1) {
-    fprintf(stderr, "socev_service err: %s\n", strerror(errno));
-    return nfds;
+    notify(ctx, EVT_CLIENT_WRITABLE, client, NULL, 0);
   }
+}
 
-  for (i = 0; i < nfds; i++) {
-    if (ctx->events[i].events & EPOLLIN) {
-      fd = ctx->events[i].data.fd;
-      if (fd == ctx->fd) {
-        // handle incoming connection
-        if (do_accept(ctx) == -1) {
-          fprintf(stderr, "do_accept failed\n");
-        }
-        continue;
-      }
+// runs the tasks queued before this call, tasks they queue themselves wait
+// for the next one; at least one task runs so that a busy loop cannot starve
+// the queue
+static void run_tasks(tcp_context* ctx, void* queue, uint64_t deadline_ns,
+                      uint16_t idle) {
+  uint32_t n = task_queue_count(queue);
+  task_fn fn;
+  void* arg;
 
-      if (client_list_get_client(ctx->client_list, fd, &get_res) == -1)
-        continue;
+  while (n-- && task_queue_pop(queue, &fn, &arg) == 0) {
+    const uint64_t start = trace_begin(ctx);
+    fn(arg);
+    trace_end(ctx, TRACE_TASK, -1, start, idle);
 
-      if (get_res.type == FD_TIMER) {
-        // process timer expired
-        client_set_timer(get_res.client, 0);     // stop the timer
-        client_enable_timer(get_res.client, 0);  // disable the timer
-        if (ctx->callback) {
-          ctx->callback(EVT_CLIENT_TIMER_EXPIRED, get_res.client, NULL, 0);
-        }
-      }
+    if (deadline_ns && trace_now() >= deadline_ns) {
+      break;
+    }
+  }
+}
 
-      // process inbound data
-      if (get_res.type == FD_REGULAR) {
-        const int recv_res = do_receive(ctx, get_res.client);
-        if (recv_res == -1) {
-          // handle receive error
-          fprintf(stderr, "do_receive failed\n");
-        } else if (recv_res == -2) {
-          // handle disconnected client
-          client_list_del_client(ctx->client_list, fd);
-        }
-      }
+// rings are checked on every pass, the doorbells only wake the loop up; a
+// link stays armed for a doorbell unless it is being polled
+static void do_shm(tcp_context* ctx, shm_peer_t* p, uint64_t now) {
+  void* client = p->client;
+  void* link = client_get_shm(client);
+
+  if (p->announce) {
+    p->announce = 0;
+    notify(ctx, EVT_CLIENT_CONNECTED, client, NULL, 0);
+  }
+
+  if (drain_shm(ctx, client)) {
+    p->active_ns = now;
+  }
+
+  if (client_has_pending_output(client) && flush_client(ctx, client)) {
+    return;
+  }
+
+  if (client_wants_writable(client) && !client_has_pending_output(client) &&
+      shm_link_has_space(link)) {
+    client_clear_callback_on_writable(client);
+    notify(ctx, EVT_CLIENT_WRITABLE, client, NULL, 0);
+  }
+
+  if (ctx->shm_poll_ns && now - p->active_ns < ctx->shm_poll_ns) {
+    ctx->shm_busy = 1;
+  } else if (shm_link_arm_read(link)) {
+    ctx->shm_busy = 1;
+  }
+
+  p->wait_space = 0;
+  if (client_has_pending_output(client) || client_wants_writable(client)) {
+    if (shm_link_arm_write(link)) {
+      ctx->shm_busy = 1;
+    } else {
+      p->wait_space = 1;
     }
-    if (ctx->events[i].events & EPOLLOUT) {
-      // process outbound data
+  }
+}
 
-      // clear pollout request of the client
-      client_clear_callback_on_writable(get_res.client);
+// backwards, a removed link is replaced by one that was already serviced
+static void service_shm(tcp_context* ctx) {
+  const uint64_t now = trace_now();
+  uint32_t i = ctx->shm_cnt;
 
-      if (ctx->callback) {
-        ctx->callback(EVT_CLIENT_WRITABLE, get_res.client, NULL, 0);
-      }
+  ctx->shm_busy = 0;
+  while (i--) {
+    if (i < ctx->shm_cnt && ctx->shm_peers[i]->client) {
+      do_shm(ctx, ctx->shm_peers[i], now);
     }
   }
+}
 
-  return nfds;
+// output queued between service calls has not asked for space yet
+static int shm_needs_pass(tcp_context* ctx) {
+  uint32_t i = 0;
+  for (; i < ctx->shm_cnt; ++i) {
+    void* client = ctx->shm_peers[i]->client;
+    if (client && !ctx->shm_peers[i]->wait_space &&
+        (client_has_pending_output(client) || client_wants_writable(client))) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void on_shm_doorbell(void* watcher, int fd, uint32_t events,
+                            void* arg) {
+  shm_peer_t* p = (shm_peer_t*)arg;
+  tcp_context* ctx = (tcp_context*)p->ctx;
+
+  shm_link_ack_doorbell(client_get_shm(p->client));
+  ctx->stats.shm_doorbells++;
+}
+
+static shm_peer_t* add_shm_peer(tcp_context* ctx, int fd) {
+  if (ctx->shm_cnt == ctx->shm_cap) {
+    const uint32_t cap = ctx->shm_cap ? ctx->shm_cap * 2 : 4;
+    shm_peer_t** peers =
+        (shm_peer_t**)realloc(ctx->shm_peers, cap * sizeof(shm_peer_t*));
+    if (!peers) {
+      LOG_ERR("cannot grow shm peers");
+      return NULL;
+    }
+    ctx->shm_peers = peers;
+    ctx->shm_cap = cap;
+  }
+
+  shm_peer_t* p = (shm_peer_t*)calloc(1, sizeof(shm_peer_t));
+  if (!p) {
+    LOG_ERR("cannot create shm peer");
+    return NULL;
+  }
+
+  p->ctx = ctx;
+  p->fd = fd;
+  p->timer_fd = -1;
+  ctx->shm_peers[ctx->shm_cnt++] = p;
+  return p;
+}
+
+// turns a connected unix socket with a mapped link into a client, the
+// peer is dropped if that fails
+static void* link_shm_peer(tcp_context* ctx, shm_peer_t* p, void* link) {
+  void* client = client_create(ctx->efd, p->fd, "local", 0);
+  if (!client) {
+    shm_link_destroy(link);
+    drop_shm_peer(ctx, p);
+    return NULL;
+  }
+
+  // the client owns the socket and the link from here on
+  client_set_shm(client, link);
+  client_set_context(client, ctx);
+
+  if (client_list_add_client(ctx->client_list, client) == -1) {
+    client_destroy(client);
+    drop_shm_peer(ctx, p);
+    return NULL;
+  }
+
+  p->watcher = tcp_context_watch_fd(ctx, shm_link_get_doorbell(link),
+                                    WATCH_READ, on_shm_doorbell, p);
+  if (!p->watcher) {
+    client_list_del_client(ctx->client_list, p->fd);
+    drop_shm_peer(ctx, p);
+    return NULL;
+  }
+
+  p->client = client;
+  p->announce = 1;
+  ctx->shm_busy = 1;
+  ctx->stats.shm_links++;
+  return client;
+}
+
+static void on_shm_hello(void* watcher, int fd, uint32_t events, void* arg) {
+  shm_peer_t* p = (shm_peer_t*)arg;
+  tcp_context* ctx = (tcp_context*)p->ctx;
+  int fds[SHM_LINK_FDS];
+
+  const int n = recv_fds(fd, fds, SHM_LINK_FDS);
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+
+  tcp_context_unwatch(ctx, watcher);
+  p->watcher = NULL;
+  stop_shm_timer(ctx, p);
+
+  void* link = n == SHM_LINK_FDS ? shm_link_attach(fds) : NULL;
+  if (!link) {
+    close(fd);
+    drop_shm_peer(ctx, p);
+    return;
+  }
+
+  link_shm_peer(ctx, p, link);
+}
+
+// a peer that connected but keeps its link to itself is dropped
+static void on_shm_hello_timeout(void* watcher, int fd, uint32_t events,
+                                 void* arg) {
+  shm_peer_t* p = (shm_peer_t*)arg;
+  tcp_context* ctx = (tcp_context*)p->ctx;
+
+  tcp_context_unwatch(ctx, p->watcher);
+  close(p->fd);
+  drop_shm_peer(ctx, p);
+}
+
+static void on_shm_accept(void* watcher, int fd, uint32_t events, void* arg) {
+  tcp_context* ctx = (tcp_context*)arg;
+
+  const int new_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (new_fd == -1) {
+    LOG_ERRNO("do_accept err");
+    return;
+  }
+
+  // pending peers hold a slot like the clients they are about to become
+  shm_peer_t* p = NULL;
+  if (client_list_get_count(ctx->client_list) + ctx->shm_pending >=
+          client_list_get_max_count(ctx->client_list) ||
+      !(p = add_shm_peer(ctx, new_fd))) {
+    close(new_fd);
+    return;
+  }
+
+  p->timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (p->timer_fd == -1) {
+    LOG_ERRNO("on_shm_accept err");
+    close(new_fd);
+    drop_shm_peer(ctx, p);
+    return;
+  }
+  ctx->shm_pending++;
+
+  // the peer sends its link right after connecting
+  p->timer = tcp_context_watch_fd(ctx, p->timer_fd, WATCH_READ,
+                                  on_shm_hello_timeout, p);
+  p->watcher = tcp_context_watch_fd(ctx, new_fd, WATCH_READ, on_shm_hello, p);
+  if (!p->timer || !p->watcher ||
+      arm_timer(p->timer_fd, SHM_HELLO_TIMEOUT_US) == -1) {
+    tcp_context_unwatch(ctx, p->watcher);
+    close(new_fd);
+    drop_shm_peer(ctx, p);
+  }
+}
+
+static int listen_shm(tcp_context* ctx, const char* path, int backlog) {
+  ctx->shm_path = strdup(path);
+  if (!ctx->shm_path) {
+    LOG_ERR("tcp_context_create err: cannot copy shm path");
+    return -1;
+  }
+
+  ctx->shm_fd = create_unix_listener_socket(path);
+  if (ctx->shm_fd == -1) {
+    return -1;
+  }
+
+  if (listen(ctx->shm_fd, backlog) == -1) {
+    LOG_ERRNO("tcp_context_create err");
+    return -1;
+  }
+
+  if (!tcp_context_watch_fd(ctx, ctx->shm_fd, WATCH_READ, on_shm_accept,
+                            ctx)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static void release_watchers(tcp_context* ctx) {
+  uint32_t i = 0, n = 0;
+  for (; i < ctx->watcher_cnt; ++i) {
+    if (watcher_is_stopped(ctx->watchers[i])) {
+      watcher_destroy(ctx->watchers[i]);
+    } else {
+      ctx->watchers[n++] = ctx->watchers[i];
+    }
+  }
+  ctx->watcher_cnt = n;
+  ctx->watchers_stopped = 0;
+}
+
+int tcp_context_service(void* tcp_ctx, int timeout_ms) {
+  int nfds, i, fd;
+  client_get_result_t get_res;
+
+  if (!tcp_ctx) {
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+
+  // epoll_ctl calls made by client helpers are attributed to this loop
+  trace_set_current(ctx->trace);
+
+  // broadcasts issued outside of the loop must not wait for an event
+  flush_groups(ctx);
+
+  // pending tasks only poll for i/o, they run right after it, and so do
+  // links the loop is polling
+  if (task_queue_count(ctx->next_tick) || task_queue_count(ctx->idle) ||
+      ctx->shm_busy || (ctx->shm_cnt && shm_needs_pass(ctx))) {
+    timeout_ms = 0;
+  }
+
+  const uint64_t start = trace_begin(ctx);
+  nfds = epoll_wait(ctx->efd, ctx->events, ctx->max_events, timeout_ms);
+  trace_end(ctx, TRACE_EPOLL_WAIT, ctx->efd, start, nfds < 0 ? 0 : nfds);
+
+  if (nfds == -1) {
+    LOG_ERRNO("socev_service err");
+    trace_set_current(NULL);
+    return nfds;
+  }
+
+  // the task budget counts from the end of the wait
+  const uint64_t deadline =
+      ctx->task_budget_ns ? trace_now() + ctx->task_budget_ns : 0;
+
+  for (i = 0; i < nfds; i++) {
+    const uint32_t events = ctx->events[i].events;
+    const uint64_t data = ctx->events[i].data.u64;
+
+    if (data & WATCHER_TAG) {
+      void* watcher = (void*)(uintptr_t)(data & ~WATCHER_TAG);
+      const uint64_t watch_start = trace_begin(ctx);
+      watcher_dispatch(watcher, events);
+      trace_end(ctx, TRACE_WATCHER, watcher_get_fd(watcher), watch_start, 0);
+      if (watcher_is_stopped(watcher)) {
+        ctx->watchers_stopped = 1;
+      }
+      continue;
+    }
+
+    fd = (int)data;
+    if (fd == ctx->fd) {
+      // handle incoming connection
+      if ((events & EPOLLIN) && do_accept(ctx) == -1) {
+        LOG_ERR("do_accept failed");
+      }
+      continue;
+    }
+
+    // the client may have been removed by an earlier event of this batch
+    if (client_list_get_client(ctx->client_list, fd, &get_res) == -1) {
+      continue;
+    }
+
+    if (get_res.type == FD_TIMER) {
+      if (events & EPOLLIN) {
+        // process timer expired
+        const uint64_t timer_start = trace_begin(ctx);
+        client_set_timer(get_res.client, 0);     // stop the timer
+        client_enable_timer(get_res.client, 0);  // disable the timer
+        trace_end(ctx, TRACE_TIMER, fd, timer_start, 0);
+        notify(ctx, EVT_CLIENT_TIMER_EXPIRED, get_res.client, NULL, 0);
+      }
+      continue;
+    }
+
+    if (get_res.type == FD_DEADLINE) {
+      do_deadline(ctx, get_res.client);
+      continue;
+    }
+
+    // the error queue carries zero-copy completions
+    if ((events & EPOLLERR) && client_has_zerocopy_pending(get_res.client)) {
+      do_zerocopy_completions(ctx, get_res.client);
+    }
+
+    if (client_is_connecting(get_res.client)) {
+      if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        do_connect(ctx, get_res.client);
+      }
+      continue;
+    }
+
+    if (client_get_tls(get_res.client) &&
+        !tls_is_established(client_get_tls(get_res.client))) {
+      do_handshake(ctx, get_res.client);
+      continue;
+    }
+
+    // proxied clients never surface their data to the callback
+    if (client_get_proxy(get_res.client)) {
+      do_proxy(ctx, get_res.client);
+      continue;
+    }
+
+    // process inbound data, a tls read that stopped on a full socket is
+    // retried once it drained
+    void* tls = client_get_tls(get_res.client);
+    if ((events & EPOLLIN) ||
+        ((events & EPOLLOUT) && tls && tls_read_wants_write(tls))) {
+      const int recv_res = do_receive(ctx, get_res.client);
+      if (recv_res == -1) {
+        // handle receive error, the connection is unusable
+        client_discard_output(get_res.client);
+        remove_client(ctx, get_res.client);
+        continue;
+      } else if (recv_res == -2) {
+        // handle disconnected client, pending output is flushed first
+        if (client_has_pending_output(get_res.client)) {
+          client_close(get_res.client);
+          client_enable_read(get_res.client, 0);
+        } else {
+          remove_client(ctx, get_res.client);
+        }
+        continue;
+      }
+    }
+
+    // process outbound data
+    if (events & EPOLLOUT) {
+      do_writable(ctx, get_res.client);
+    }
+  }
+
+  run_tasks(ctx, ctx->next_tick, deadline, 0);
+
+  if (nfds == 0 && !task_queue_count(ctx->next_tick) &&
+      (!deadline || trace_now() < deadline)) {
+    run_tasks(ctx, ctx->idle, deadline, 1);
+  }
+
+  flush_groups(ctx);
+
+  if (ctx->shm_cnt) {
+    service_shm(ctx);
+  }
+
+  // no event of this batch refers to a stopped watcher any more
+  if (ctx->watchers_stopped) {
+    release_watchers(ctx);
+  }
+
+  trace_set_current(NULL);
+
+  if (ctx->trace_dump_requested) {
+    ctx->trace_dump_requested = 0;
+    tcp_context_trace_dump(ctx, ctx->trace_dump_path);
+  }
+
+  // errors of this iteration are formatted after its callbacks ran
+  log_poll();
+
+  return nfds;
+}
+
+void* tcp_context_get_user(void* tcp_ctx) {
+  if (tcp_ctx) {
+    tcp_context* ctx = (tcp_context*)(tcp_ctx);
+    return ctx->user;
+  }
+
+  return NULL;
+}
+
+int tcp_context_get_stats(void* tcp_ctx, tcp_context_stats* out) {
+  if (!tcp_ctx || !out) {
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  *out = ctx->stats;
+  return 0;
+}
+
+int tcp_context_defer(void* tcp_ctx, void (*fn)(void* arg), void* arg) {
+  if (!tcp_ctx) {
+    LOG_ERR("tcp_context_defer err: invalid argument");
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return task_queue_push(ctx->next_tick, fn, arg);
+}
+
+int tcp_context_idle(void* tcp_ctx, void (*fn)(void* arg), void* arg) {
+  if (!tcp_ctx) {
+    LOG_ERR("tcp_context_idle err: invalid argument");
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return task_queue_push(ctx->idle, fn, arg);
+}
+
+uint32_t tcp_context_pending_tasks(void* tcp_ctx) {
+  if (!tcp_ctx) {
+    return 0;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return task_queue_count(ctx->next_tick) + task_queue_count(ctx->idle);
+}
+
+static void* add_watcher(tcp_context* ctx, void* watcher) {
+  if (!watcher) {
+    return NULL;
+  }
+
+  if (ctx->watcher_cnt == ctx->watcher_cap) {
+    const uint32_t cap = ctx->watcher_cap ? ctx->watcher_cap * 2 : 4;
+    void** watchers = (void**)realloc(ctx->watchers, cap * sizeof(void*));
+    if (!watchers) {
+      LOG_ERR("cannot grow watchers");
+      watcher_destroy(watcher);
+      return NULL;
+    }
+    ctx->watchers = watchers;
+    ctx->watcher_cap = cap;
+  }
+
+  ctx->watchers[ctx->watcher_cnt++] = watcher;
+  return watcher;
+}
+
+void* tcp_context_watch_fd(void* tcp_ctx, int fd, uint32_t interest,
+                           fd_watch_callback cb, void* arg) {
+  if (!tcp_ctx) {
+    LOG_ERR("tcp_context_watch_fd err: invalid argument");
+    return NULL;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return add_watcher(ctx, watcher_create_fd(ctx->efd, fd, interest, cb, arg));
+}
+
+int tcp_context_watch_fd_modify(void* watcher, uint32_t interest) {
+  return watcher_set_interest(watcher, interest);
+}
+
+void* tcp_context_watch_signal(void* tcp_ctx, int signo,
+                               signal_watch_callback cb, void* arg) {
+  if (!tcp_ctx) {
+    LOG_ERR("tcp_context_watch_signal err: invalid argument");
+    return NULL;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return add_watcher(ctx, watcher_create_signal(ctx->efd, signo, cb, arg));
+}
+
+void* tcp_context_watch_child(void* tcp_ctx, pid_t pid,
+                              child_watch_callback cb, void* arg) {
+  if (!tcp_ctx) {
+    LOG_ERR("tcp_context_watch_child err: invalid argument");
+    return NULL;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return add_watcher(ctx, watcher_create_child(ctx->efd, pid, cb, arg));
+}
+
+void tcp_context_unwatch(void* tcp_ctx, void* watcher) {
+  if (tcp_ctx && watcher) {
+    tcp_context* ctx = (tcp_context*)(tcp_ctx);
+    // released at the end of the service call, an event of the current
+    // batch may still point at it
+    watcher_stop(watcher);
+    ctx->watchers_stopped = 1;
+  }
+}
+
+int tcp_context_capture_start(void* tcp_ctx, const char* path) {
+  if (!tcp_ctx) {
+    LOG_ERR("tcp_context_capture_start err: invalid argument");
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  void* capture = capture_create(path);
+  if (!capture) {
+    return -1;
+  }
+
+  capture_destroy(ctx->capture);
+  ctx->capture = capture;
+  return 0;
+}
+
+void tcp_context_capture_stop(void* tcp_ctx) {
+  if (tcp_ctx) {
+    tcp_context* ctx = (tcp_context*)(tcp_ctx);
+    capture_destroy(ctx->capture);
+    ctx->capture = NULL;
+  }
+}
+
+int tcp_context_trace_enable(void* tcp_ctx, uint32_t capacity) {
+  if (!tcp_ctx) {
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+
+  // asking for a larger ring starts over with a fresh one
+  if (ctx->trace_ring && trace_get_capacity(ctx->trace_ring) < capacity) {
+    trace_destroy(ctx->trace_ring);
+    ctx->trace_ring = NULL;
+  }
+
+  if (!ctx->trace_ring) {
+    ctx->trace_ring = trace_create(capacity);
+    if (!ctx->trace_ring) {
+      return -1;
+    }
+  }
+
+  ctx->trace = ctx->trace_ring;
+  return 0;
+}
+
+void tcp_context_trace_disable(void* tcp_ctx) {
+  if (tcp_ctx) {
+    tcp_context* ctx = (tcp_context*)(tcp_ctx);
+    ctx->trace = NULL;
+  }
+}
+
+int tcp_context_trace_dump(void* tcp_ctx, const char* path) {
+  if (!tcp_ctx) {
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  if (!ctx->trace_ring) {
+    LOG_ERR("tcp_context_trace_dump err: tracing never enabled");
+    return -1;
+  }
+
+  return trace_dump_chrome(ctx->trace_ring, path);
+}
+
+void tcp_context_trace_request_dump(void* tcp_ctx, const char* path) {
+  if (tcp_ctx) {
+    tcp_context* ctx = (tcp_context*)(tcp_ctx);
+    ctx->trace_dump_path = path;
+    ctx->trace_dump_requested = 1;
+  }
+}
+
+void* tcp_context_connect(void* tcp_ctx, const char* ip, uint16_t port) {
+  if (!tcp_ctx || !ip) {
+    LOG_ERR("tcp_context_connect err: invalid argument");
+    return NULL;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+
+  if (client_list_is_full(ctx->client_list)) {
+    LOG_ERR("tcp_context_connect err: client list is full");
+    return NULL;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) {
+    LOG_ERR("tcp_context_connect err: invalid address");
+    return NULL;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd == -1) {
+    LOG_ERRNO("tcp_context_connect err");
+    return NULL;
+  }
+
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 &&
+      errno != EINPROGRESS) {
+    LOG_ERRNO("tcp_context_connect err");
+    close(fd);
+    return NULL;
+  }
+
+  void* client = client_create(ctx->efd, fd, ip, port);
+  if (!client) {
+    return NULL;
+  }
+
+  if (client_list_add_client(ctx->client_list, client) == -1) {
+    client_destroy(client);
+    return NULL;
+  }
+
+  client_set_context(client, ctx);
+  if (ctx->zerocopy_threshold) {
+    client_set_zerocopy_threshold(client, ctx->zerocopy_threshold);
+  }
+  client_set_connecting(client, 1);
+  return client;
+}
+
+void* tcp_context_connect_shm(void* tcp_ctx, const char* path) {
+  if (!tcp_ctx || !path) {
+    LOG_ERR("tcp_context_connect_shm err: invalid argument");
+    return NULL;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+
+  if (client_list_is_full(ctx->client_list)) {
+    LOG_ERR("tcp_context_connect_shm err: client list is full");
+    return NULL;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    LOG_ERR("tcp_context_connect_shm err: path too long");
+    return NULL;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    LOG_ERRNO("tcp_context_connect_shm err");
+    return NULL;
+  }
+
+  // a unix socket connects at once or not at all
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    LOG_ERRNO("tcp_context_connect_shm err");
+    close(fd);
+    return NULL;
+  }
+
+  // the side that connects creates the link and hands it over
+  int fds[SHM_LINK_FDS];
+  void* link = shm_link_create(ctx->shm_ring_size, fds);
+  if (!link || send_fds(fd, fds, SHM_LINK_FDS) == -1) {
+    shm_link_destroy(link);
+    close(fd);
+    return NULL;
+  }
+
+  shm_peer_t* p = add_shm_peer(ctx, fd);
+  if (!p) {
+    shm_link_destroy(link);
+    close(fd);
+    return NULL;
+  }
+
+  return link_shm_peer(ctx, p, link);
+}
+
+int tcp_context_proxy(void* tcp_ctx, void* a, void* b) {
+  if (!tcp_ctx || !a || !b) {
+    LOG_ERR("tcp_context_proxy err: invalid argument");
+    return -1;
+  }
+
+  if (client_get_proxy(a) || client_get_proxy(b) ||
+      client_has_pending_output(a) || client_has_pending_output(b)) {
+    LOG_ERR("tcp_context_proxy err: clients are busy");
+    return -1;
+  }
+
+  // splice sees plaintext only where the kernel owns the records
+  if ((client_get_tls(a) && !(tls_ktls_send(client_get_tls(a)) &&
+                              tls_ktls_recv(client_get_tls(a)))) ||
+      (client_get_tls(b) && !(tls_ktls_send(client_get_tls(b)) &&
+                              tls_ktls_recv(client_get_tls(b))))) {
+    LOG_ERR("tcp_context_proxy err: tls is not offloaded to the kernel");
+    return -1;
+  }
+
+  if (client_get_shm(a) || client_get_shm(b)) {
+    LOG_ERR("tcp_context_proxy err: shm clients have no socket data");
+    return -1;
+  }
+
+  void* proxy = proxy_create(a, b);
+  if (!proxy) {
+    return -1;
+  }
+
+  client_set_proxy(a, proxy);
+  client_set_proxy(b, proxy);
+
+  // the loop pumps on the next readiness of either side, a side waits for
+  // its peer to connect before it is read
+  if (!client_is_connecting(a)) {
+    client_set_interest(a, !client_is_connecting(b), 0);
+  }
+  if (!client_is_connecting(b)) {
+    client_set_interest(b, !client_is_connecting(a), 0);
+  }
+
+  return 0;
+}
+
+static void* find_group(tcp_context* ctx, const char* name) {
+  uint32_t i = 0;
+  for (; i < ctx->group_cnt; ++i) {
+    if (strcmp(group_get_name(ctx->groups[i]), name) == 0) {
+      return ctx->groups[i];
+    }
+  }
+
+  return NULL;
+}
+
+int tcp_context_group_join(void* tcp_ctx, const char* name, void* client) {
+  if (!tcp_ctx || !name || !client) {
+    LOG_ERR("tcp_context_group_join err: invalid argument");
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  void* group = find_group(ctx, name);
+
+  if (!group) {
+    if (ctx->group_cnt == ctx->group_cap) {
+      const uint32_t cap = ctx->group_cap ? ctx->group_cap * 2 : 4;
+      void** groups = (void**)realloc(ctx->groups, cap * sizeof(void*));
+      if (!groups) {
+        LOG_ERR("tcp_context_group_join err: cannot grow groups");
+        return -1;
+      }
+      ctx->groups = groups;
+      ctx->group_cap = cap;
+    }
+
+    group = group_create(name);
+    if (!group) {
+      return -1;
+    }
+    ctx->groups[ctx->group_cnt++] = group;
+  }
+
+  return group_add_client(group, client);
+}
+
+int tcp_context_group_leave(void* tcp_ctx, const char* name, void* client) {
+  if (!tcp_ctx || !name || !client) {
+    LOG_ERR("tcp_context_group_leave err: invalid argument");
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  void* group = find_group(ctx, name);
+  if (!group) {
+    return -1;
+  }
+
+  return group_del_client(group, client);
+}
+
+uint32_t tcp_context_group_count(void* tcp_ctx, const char* name) {
+  if (!tcp_ctx || !name) {
+    return 0;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  return group_get_count(find_group(ctx, name));
+}
+
+typedef struct {
+  tcp_context* ctx;
+  void* payload;
+  int queued;
+} broadcast_t;
+
+static void enqueue_member(void* client, void* arg) {
+  broadcast_t* b = (broadcast_t*)arg;
+
+  if (client_is_slow(client) || client_is_closing(client)) {
+    return;
+  }
+
+  if (client_enqueue(client, b->payload) == 0) {
+    b->queued++;
+    check_slow(b->ctx, client);
+  }
+}
+
+int tcp_context_broadcast(void* tcp_ctx, const char* name, const void* data,
+                          uint32_t len) {
+  if (!tcp_ctx || !name) {
+    LOG_ERR("tcp_context_broadcast err: invalid argument");
+    return -1;
+  }
+
+  tcp_context* ctx = (tcp_context*)(tcp_ctx);
+  void* group = find_group(ctx, name);
+  if (!group || !len) {
+    return 0;
+  }
+
+  broadcast_t b = {.ctx = ctx, .payload = payload_create(data, len)};
+  if (!b.payload) {
+    return -1;
+  }
+
+  group_foreach(group, enqueue_member, &b);
+  group_set_dirty(group, 1);
+
+  // members hold their own references
+  payload_unref(b.payload);
+  return b.queued;
 }
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include "tls.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "log.h"
+
+typedef struct {
+  SSL* ssl;
+  int established;
+  int read_wants_write;
+} tls_t;
+
+// only the code of the oldest queued OpenSSL error fits into a log record
+#define LOG_SSL_ERR(what)                                  \
+  do {                                                     \
+    LOG_ERR(what ": openssl error %lx", ERR_peek_error()); \
+    ERR_clear_error();                                     \
+  } while (0)
+
+void* tls_config_create(const char* cert_file, const char* key_file,
+                        int ktls) {
+  SSL_CTX* ctx = NULL;
+
+  if (!cert_file || !key_file) {
+    LOG_ERR("tls_config_create err: invalid argument");
+    goto create_err;
+  }
+
+  ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) {
+    LOG_SSL_ERR("SSL_CTX_new");
+    goto create_err;
+  }
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  // records are retried from the send queue, whose storage may move
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  // client_close ends the read side with a local shutdown, and peers often
+  // leave without close_notify, both are a plain end of stream here
+  SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+  if (ktls) {
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+  }
+
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1) {
+    LOG_SSL_ERR("tls_config_create err: cannot load certificate");
+    goto create_err;
+  }
+
+  return ctx;
+
+create_err:
+  tls_config_destroy(ctx);
+  return NULL;
+}
+
+void tls_config_destroy(void* config) {
+  if (config) {
+    SSL_CTX_free((SSL_CTX*)config);
+  }
+}
+
+void* tls_create(void* config, int fd) {
+  tls_t* t = NULL;
+
+  if (!config || fd == -1) {
+    LOG_ERR("tls_create err: invalid argument");
+    goto create_err;
+  }
+
+  t = (tls_t*)calloc(1, sizeof(tls_t));
+  if (!t) {
+    LOG_ERR("cannot create tls session");
+    goto create_err;
+  }
+
+  t->ssl = SSL_new((SSL_CTX*)config);
+  if (!t->ssl || SSL_set_fd(t->ssl, fd) != 1) {
+    LOG_SSL_ERR("tls_create err");
+    goto create_err;
+  }
+  SSL_set_accept_state(t->ssl);
+
+  return t;
+
+create_err:
+  tls_destroy(t);
+  return NULL;
+}
+
+void tls_destroy(void* tls) {
+  if (tls) {
+    tls_t* t = (tls_t*)tls;
+    if (t->ssl) {
+      // best effort, a peer that already left gets no alert
+      if (t->established) {
+        SSL_shutdown(t->ssl);
+      }
+      SSL_free(t->ssl);
+    }
+    ERR_clear_error();
+    free(t);
+  }
+}
+
+// maps an SSL_ERROR_* to errno so that callers handle it like a socket
+static ssize_t io_result(tls_t* t, int ret) {
+  switch (SSL_get_error(t->ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      errno = EAGAIN;
+      return -1;
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_SYSCALL:
+      ERR_clear_error();
+      if (!errno) {
+        errno = ECONNRESET;
+      }
+      return -1;
+    default:
+      LOG_SSL_ERR("tls i/o err");
+      errno = EPROTO;
+      return -1;
+  }
+}
+
+int tls_handshake(void* tls) {
+  tls_t* t = (tls_t*)tls;
+  if (!t) {
+    return -1;
+  }
+
+  errno = 0;
+  const int ret = SSL_do_handshake(t->ssl);
+  if (ret == 1) {
+    t->established = 1;
+    return TLS_DONE;
+  }
+
+  switch (SSL_get_error(t->ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+      return TLS_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+      return TLS_WANT_WRITE;
+    case SSL_ERROR_SYSCALL:
+      // the peer went away during the handshake
+      ERR_clear_error();
+      return -1;
+    default:
+      LOG_SSL_ERR("tls_handshake err");
+      return -1;
+  }
+}
+
+int tls_is_established(void* tls) {
+  tls_t* t = (tls_t*)tls;
+  return t && t->established;
+}
+
+int tls_ktls_send(void* tls) {
+  tls_t* t = (tls_t*)tls;
+  return t && t->established && BIO_get_ktls_send(SSL_get_wbio(t->ssl));
+}
+
+int tls_ktls_recv(void* tls) {
+  tls_t* t = (tls_t*)tls;
+  return t && t->established && BIO_get_ktls_recv(SSL_get_rbio(t->ssl));
+}
+
+ssize_t tls_read(void* tls, void* buf, size_t len) {
+  tls_t* t = (tls_t*)tls;
+  size_t bytes = 0;
+
+  errno = 0;
+  t->read_wants_write = 0;
+  const int ret = SSL_read_ex(t->ssl, buf, len, &bytes);
+  if (ret == 1) {
+    return (ssize_t)bytes;
+  }
+
+  t->read_wants_write = SSL_get_error(t->ssl, ret) == SSL_ERROR_WANT_WRITE;
+  return io_result(t, ret);
+}
+
+ssize_t tls_write(void* tls, const void* buf, size_t len) {
+  tls_t* t = (tls_t*)tls;
+  size_t bytes = 0;
+
+  errno = 0;
+  const int ret = SSL_write_ex(t->ssl, buf, len, &bytes);
+  if (ret == 1) {
+    return (ssize_t)bytes;
+  }
+
+  const ssize_t res = io_result(t, ret);
+  // a peer that left is an error for a writer, not an end of stream
+  if (res == 0) {
+    errno = EPIPE;
+    return -1;
+  }
+  return res;
+}
+
+int tls_read_wants_write(void* tls) {
+  tls_t* t = (tls_t*)tls;
+  return t && t->read_wants_write;
+}
+
+int tls_pending(void* tls) {
+  tls_t* t = (tls_t*)tls;
+  return t ? SSL_pending(t->ssl) : 0;
+}
+
+ssize_t tls_sendfile(void* tls, int in_fd, off_t offset, size_t len) {
+  tls_t* t = (tls_t*)tls;
+
+  errno = 0;
+  const ossl_ssize_t ret = SSL_sendfile(t->ssl, in_fd, offset, len, 0);
+  if (ret >= 0) {
+    return ret;
+  }
+
+  // SSL_sendfile passes sendfile errors through
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    ERR_clear_error();
+    return -1;
+  }
+
+  LOG_SSL_ERR("tls_sendfile err");
+  return -1;
+}
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+typedef struct {
+  uint32_t mask;
+  pid_t pid;
+  pid_t tid;
+  // only the loop thread writes, readers see whole slots up to head
+  _Atomic uint64_t head;
+  trace_record_t* records;
+} trace_t;
+
+static const char* trace_names[__TRACE_MAX_COUNT] = {
+    "epoll_wait", "accept", "recv", "callback", "epoll_ctl", "timer", "task",
+    "watcher"};
+
+static __thread void* current_trace;
+
+void* trace_create(uint32_t capacity) {
+  trace_t* t = NULL;
+
+  if (capacity == 0) {
+    LOG_ERR("invalid trace capacity: %u", capacity);
+    return NULL;
+  }
+
+  t = (trace_t*)calloc(1, sizeof(trace_t));
+  if (!t) {
+    LOG_ERR("cannot create trace");
+    goto create_err;
+  }
+
+  // round up to a power of two so that the slot is a mask away
+  uint32_t cap = 1;
+  while (cap < capacity && cap < (1u << 31)) {
+    cap <<= 1;
+  }
+
+  t->mask = cap - 1;
+  t->pid = getpid();
+  t->tid = (pid_t)syscall(SYS_gettid);
+  atomic_init(&t->head, 0);
+  t->records = (trace_record_t*)calloc(cap, sizeof(trace_record_t));
+  if (!t->records) {
+    LOG_ERR("cannot create trace records");
+    goto create_err;
+  }
+
+  return t;
+
+create_err:
+  trace_destroy(t);
+  return NULL;
+}
+
+void trace_destroy(void* trace) {
+  if (trace) {
+    trace_t* t = (trace_t*)trace;
+    if (current_trace == t) {
+      current_trace = NULL;
+    }
+    free(t->records);
+    free(t);
+  }
+}
+
+uint32_t trace_get_capacity(void* trace) {
+  if (trace) {
+    trace_t* t = (trace_t*)trace;
+    return t->mask + 1;
+  }
+
+  return 0;
+}
+
+uint64_t trace_get_count(void* trace) {
+  if (trace) {
+    trace_t* t = (trace_t*)trace;
+    return atomic_load_explicit(&t->head, memory_order_acquire);
+  }
+
+  return 0;
+}
+
+uint64_t trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void trace_record(void* trace, uint16_t type, int fd, uint64_t start_ns,
+                  uint16_t arg) {
+  if (!trace) {
+    return;
+  }
+
+  trace_t* t = (trace_t*)trace;
+  const uint64_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+  const uint64_t dur = trace_now() - start_ns;
+
+  trace_record_t* rec = &t->records[head & t->mask];
+  rec->ts_ns = start_ns;
+  rec->dur_ns = dur > UINT32_MAX ? UINT32_MAX : (uint32_t)dur;
+  rec->fd = fd;
+  rec->type = type;
+  rec->arg = arg;
+
+  atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+int trace_dump_chrome(void* trace, const char* path) {
+  if (!trace || !path) {
+    LOG_ERR("trace_dump_chrome err: invalid argument");
+    return -1;
+  }
+
+  trace_t* t = (trace_t*)trace;
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    LOG_ERRNO("trace_dump_chrome err");
+    return -1;
+  }
+
+  // oldest records are overwritten once the ring wraps
+  const uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+  const uint64_t cap = (uint64_t)t->mask + 1;
+  uint64_t i = head > cap ? head - cap : 0;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for (int first = 1; i < head; ++i, first = 0) {
+    const trace_record_t* rec = &t->records[i & t->mask];
+    const char* name =
+        rec->type < __TRACE_MAX_COUNT ? trace_names[rec->type] : "unknown";
+    fprintf(f,
+            "%s\n{\"name\":\"%s\",\"cat\":\"socev\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"fd\":%d,\"arg\":%u}}",
+            first ? "" : ",", name, rec->ts_ns / 1e3, rec->dur_ns / 1e3,
+            t->pid, t->tid, rec->fd, rec->arg);
+  }
+  fprintf(f, "\n]}\n");
+
+  if (fclose(f) != 0) {
+    LOG_ERRNO("trace_dump_chrome err");
+    return -1;
+  }
+
+  return 0;
+}
+
+void trace_set_current(void* trace) { current_trace = trace; }
+
+void* trace_get_current(void) { return current_trace; }
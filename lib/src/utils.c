@@ -1,20 +1,27 @@
+#define _GNU_SOURCE
 #include "utils.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
-#include <stdio.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "log.h"
+
 int set_socket_nonblocking(int fd) {
   int flags = fcntl(fd, F_GETFL, 0);
   if (flags == -1) {
-    fprintf(stderr, "get socket flags err: %s\n", strerror(errno));
+    LOG_ERRNO("get socket flags err");
     return -1;
   }
 
@@ -23,23 +30,61 @@ int set_socket_nonblocking(int fd) {
   int result = fcntl(fd, F_SETFL, flags);
 
   if (result == -1) {
-    fprintf(stderr, "set socket flags err: %s\n", strerror(errno));
+    LOG_ERRNO("set socket flags err");
   }
 
   return result;
 }
 
-int create_listener_socket(uint16_t port) {
+int set_socket_nodelay(int fd) {
+  const int optval = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) ==
+      -1) {
+    LOG_ERRNO("set socket nodelay err");
+    return -1;
+  }
+
+  return 0;
+}
+
+int set_socket_incoming_cpu(int fd, int cpu) {
+  if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+    LOG_ERRNO("set incoming cpu err");
+    return -1;
+  }
+
+  return 0;
+}
+
+int get_socket_incoming_cpu(int fd) {
+  int cpu = -1;
+  socklen_t len = sizeof(cpu);
+  if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1) {
+    return -1;
+  }
+
+  return cpu;
+}
+
+int create_listener_socket(uint16_t port, int reuseport) {
   int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (socket_fd == -1) {
-    fprintf(stderr, "create_listener_socket err: %s\n", strerror(errno));
+    LOG_ERRNO("create_listener_socket err");
     return -1;
   }
 
   const int optval = 1;
   if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &optval,
                  sizeof(optval)) == -1) {
-    fprintf(stderr, "create_listener_socket err: %s\n", strerror(errno));
+    LOG_ERRNO("create_listener_socket err");
+    close(socket_fd);
+    return -1;
+  }
+
+  // several loops may share the port, the kernel spreads flows among them
+  if (reuseport && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                              sizeof(optval)) == -1) {
+    LOG_ERRNO("create_listener_socket err");
     close(socket_fd);
     return -1;
   }
@@ -53,7 +98,7 @@ int create_listener_socket(uint16_t port) {
 
   if (bind(socket_fd, (struct sockaddr*)(&server),
            sizeof(struct sockaddr_in)) == -1) {
-    fprintf(stderr, "create_listener_socket err: %s\n", strerror(errno));
+    LOG_ERRNO("create_listener_socket err");
     close(socket_fd);
     return -1;
   }
@@ -61,10 +106,157 @@ int create_listener_socket(uint16_t port) {
   return socket_fd;
 }
 
+int create_unix_listener_socket(const char* path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    LOG_ERR("create_unix_listener_socket err: path too long");
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (socket_fd == -1) {
+    LOG_ERRNO("create_unix_listener_socket err");
+    return -1;
+  }
+
+  unlink(path);
+  if (bind(socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    LOG_ERRNO("create_unix_listener_socket err");
+    close(socket_fd);
+    return -1;
+  }
+
+  return socket_fd;
+}
+
+int send_fds(int fd, const int* fds, int n) {
+  char control[CMSG_SPACE(sizeof(int) * 4)];
+  char byte = 0;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+  if (n > 4) {
+    LOG_ERR("send_fds err: too many fds %d", n);
+    return -1;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+
+  struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * n);
+  memcpy(CMSG_DATA(cm), fds, sizeof(int) * n);
+
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1) {
+    LOG_ERRNO("send_fds err");
+    return -1;
+  }
+
+  return 0;
+}
+
+int recv_fds(int fd, int* fds, int n) {
+  char control[CMSG_SPACE(sizeof(int) * 4)];
+  char byte;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+
+  if (n > 4) {
+    LOG_ERR("recv_fds err: too many fds %d", n);
+    return -1;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  const ssize_t bytes = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  if (bytes <= 0) {
+    return (int)bytes;
+  }
+
+  int got = 0;
+  int sets = 0;
+  struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+  for (; cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      got += (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      sets++;
+    }
+  }
+
+  // only one complete set of n is handed over, whatever else arrived is
+  // closed here or it would leak
+  const int ok = sets == 1 && got == n && !(msg.msg_flags & MSG_CTRUNC);
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    if (ok) {
+      memcpy(fds, CMSG_DATA(cm), sizeof(int) * n);
+      return n;
+    }
+    const int cnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int i = 0;
+    for (; i < cnt; ++i) {
+      int extra;
+      memcpy(&extra, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+      close(extra);
+    }
+  }
+
+  LOG_ERR("recv_fds err: expected %d fds, got %d", n, got);
+  errno = EPROTO;
+  return -1;
+}
+
+int pin_thread_to_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  // pid 0 applies the mask to the calling thread only
+  if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+    LOG_ERRNO("pin_thread_to_cpu err");
+    return -1;
+  }
+
+  return 0;
+}
+
+void* alloc_local(size_t size) {
+  // pages are faulted in by the calling thread, so the default first-touch
+  // policy places them on the numa node of the cpu the caller runs on
+  void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ptr == MAP_FAILED) {
+    LOG_ERRNO("alloc_local err");
+    return NULL;
+  }
+
+  return ptr;
+}
+
+void free_local(void* ptr, size_t size) {
+  if (ptr) {
+    munmap(ptr, size);
+  }
+}
+
 struct timespec to_timespec(const int64_t interval_us) {
-  struct timespec ts = {
-      .tv_sec = interval_us / 1e6,
-      .tv_nsec = (interval_us - (interval_us / 1e6) * 1e6) * 1e6};
+  struct timespec ts = {.tv_sec = interval_us / 1000000,
+                        .tv_nsec = (interval_us % 1000000) * 1000};
 
   return ts;
 }
@@ -73,7 +265,7 @@ int arm_timer(int timer_fd, const int64_t interval_us) {
   struct timespec now;
   int result = clock_gettime(CLOCK_REALTIME, &now);
   if (result == -1) {
-    fprintf(stderr, "clock_gettime err: %s\n", strerror(errno));
+    LOG_ERRNO("clock_gettime err");
     return -1;
   }
 
@@ -84,8 +276,13 @@ int arm_timer(int timer_fd, const int64_t interval_us) {
       .it_value = {.tv_sec = now.tv_sec + ti.tv_sec,
                    .tv_nsec = now.tv_nsec + ti.tv_nsec}};
 
+  if (new_value.it_value.tv_nsec >= 1000000000) {
+    new_value.it_value.tv_sec++;
+    new_value.it_value.tv_nsec -= 1000000000;
+  }
+
   if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
-    fprintf(stderr, "timerfd_settime err: %s\n", strerror(errno));
+    LOG_ERRNO("timerfd_settime err");
     return -1;
   }
 
@@ -96,7 +293,7 @@ int disarm_timer(int timer_fd) {
   struct itimerspec new_value = {};
 
   if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &new_value, NULL) == -1) {
-    fprintf(stderr, "cannot disarm timer: [%s]\n", strerror(errno));
+    LOG_ERRNO("cannot disarm timer");
     return -1;
   }
 
@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include "watcher.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "epoll_helper.h"
+#include "log.h"
+
+typedef enum { WATCHER_FD = 0, WATCHER_SIGNAL, WATCHER_CHILD } watcher_type;
+
+typedef struct {
+  watcher_type type;
+  int efd;
+  int fd;
+  int stopped;
+  union {
+    fd_watch_callback on_fd;
+    signal_watch_callback on_signal;
+    child_watch_callback on_child;
+  } cb;
+  void* arg;
+  int signo;
+  int unblock;  // signo was unblocked before the watcher blocked it
+  pid_t pid;
+} watcher_t;
+
+static inline uint64_t tag_of(watcher_t* w) {
+  return WATCHER_TAG | (uint64_t)(uintptr_t)w;
+}
+
+static uint32_t to_epoll(uint32_t interest) {
+  return ((interest & WATCH_READ) ? EPOLLIN : 0) |
+         ((interest & WATCH_WRITE) ? EPOLLOUT : 0);
+}
+
+static watcher_t* create(int efd, int fd, watcher_type type, void* arg) {
+  watcher_t* w = (watcher_t*)calloc(1, sizeof(watcher_t));
+  if (!w) {
+    LOG_ERR("cannot create watcher");
+    return NULL;
+  }
+
+  w->type = type;
+  w->efd = efd;
+  w->fd = fd;
+  w->arg = arg;
+  return w;
+}
+
+void* watcher_create_fd(int efd, int fd, uint32_t interest,
+                        fd_watch_callback cb, void* arg) {
+  if (fd < 0 || !cb) {
+    LOG_ERR("watcher_create_fd err: invalid argument");
+    return NULL;
+  }
+
+  watcher_t* w = create(efd, fd, WATCHER_FD, arg);
+  if (!w) {
+    return NULL;
+  }
+  w->cb.on_fd = cb;
+
+  if (epoll_ctl_add_tagged(efd, fd, to_epoll(interest), tag_of(w)) == -1) {
+    free(w);
+    return NULL;
+  }
+
+  return w;
+}
+
+void* watcher_create_signal(int efd, int signo, signal_watch_callback cb,
+                            void* arg) {
+  watcher_t* w = NULL;
+  sigset_t mask, old;
+
+  if (!cb) {
+    LOG_ERR("watcher_create_signal err: invalid argument");
+    return NULL;
+  }
+
+  sigemptyset(&mask);
+  if (sigaddset(&mask, signo) == -1) {
+    LOG_ERRNO("watcher_create_signal err");
+    return NULL;
+  }
+
+  // a blocked signal stays pending until the signalfd is read
+  if (pthread_sigmask(SIG_BLOCK, &mask, &old) != 0) {
+    LOG_ERR("watcher_create_signal err: cannot block signal %d", signo);
+    return NULL;
+  }
+
+  w = create(efd, -1, WATCHER_SIGNAL, arg);
+  if (!w) {
+    goto create_err;
+  }
+  w->cb.on_signal = cb;
+  w->signo = signo;
+  w->unblock = !sigismember(&old, signo);
+
+  w->fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (w->fd == -1) {
+    LOG_ERRNO("signalfd");
+    goto create_err;
+  }
+
+  if (epoll_ctl_add_tagged(efd, w->fd, EPOLLIN, tag_of(w)) == -1) {
+    goto create_err;
+  }
+
+  return w;
+
+create_err:
+  if (w) {
+    watcher_destroy(w);
+  } else if (!sigismember(&old, signo)) {
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+  }
+  return NULL;
+}
+
+void* watcher_create_child(int efd, pid_t pid, child_watch_callback cb,
+                           void* arg) {
+  if (pid <= 0 || !cb) {
+    LOG_ERR("watcher_create_child err: invalid argument");
+    return NULL;
+  }
+
+  watcher_t* w = create(efd, -1, WATCHER_CHILD, arg);
+  if (!w) {
+    return NULL;
+  }
+  w->cb.on_child = cb;
+  w->pid = pid;
+
+  // the pidfd becomes readable once the process exits
+  w->fd = (int)syscall(SYS_pidfd_open, pid, 0);
+  if (w->fd == -1) {
+    LOG_ERRNO("pidfd_open");
+    goto create_err;
+  }
+
+  if (epoll_ctl_add_tagged(efd, w->fd, EPOLLIN, tag_of(w)) == -1) {
+    goto create_err;
+  }
+
+  return w;
+
+create_err:
+  watcher_destroy(w);
+  return NULL;
+}
+
+void watcher_stop(void* watcher) {
+  watcher_t* w = (watcher_t*)watcher;
+  if (!w || w->stopped) {
+    return;
+  }
+
+  w->stopped = 1;
+  if (w->fd == -1) {
+    return;
+  }
+
+  epoll_ctl_del(w->efd, w->fd);
+
+  if (w->type != WATCHER_FD) {
+    close(w->fd);
+  }
+
+  if (w->type == WATCHER_SIGNAL && w->unblock) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, w->signo);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+  }
+}
+
+void watcher_destroy(void* watcher) {
+  if (watcher) {
+    watcher_stop(watcher);
+    free(watcher);
+  }
+}
+
+int watcher_set_interest(void* watcher, uint32_t interest) {
+  watcher_t* w = (watcher_t*)watcher;
+  if (!w || w->stopped || w->type != WATCHER_FD) {
+    LOG_ERR("watcher_set_interest err: invalid watcher");
+    return -1;
+  }
+
+  return epoll_ctl_change_tagged(w->efd, w->fd, to_epoll(interest),
+                                 tag_of(w));
+}
+
+int watcher_is_stopped(void* watcher) {
+  watcher_t* w = (watcher_t*)watcher;
+  return !w || w->stopped;
+}
+
+int watcher_get_fd(void* watcher) {
+  watcher_t* w = (watcher_t*)watcher;
+  return w ? w->fd : -1;
+}
+
+static void dispatch_signal(watcher_t* w) {
+  struct signalfd_siginfo info;
+
+  // the callback may stop the watcher and close the signalfd
+  while (!w->stopped) {
+    const ssize_t n = read(w->fd, &info, sizeof(info));
+    if (n != sizeof(info)) {
+      if (n == -1 && errno != EAGAIN) {
+        LOG_ERRNO("signalfd read");
+      }
+      return;
+    }
+    w->cb.on_signal(w, (int)info.ssi_signo, w->arg);
+  }
+}
+
+static void dispatch_child(watcher_t* w) {
+  int status = 0;
+  const pid_t pid = waitpid(w->pid, &status, WNOHANG);
+  if (pid == 0) {
+    return;
+  }
+
+  if (pid == -1) {
+    // reaped elsewhere, the exit status is lost
+    LOG_ERRNO("waitpid %d", w->pid);
+    status = 0;
+  }
+
+  w->cb.on_child(w, w->pid, status, w->arg);
+  watcher_stop(w);
+}
+
+void watcher_dispatch(void* watcher, uint32_t events) {
+  watcher_t* w = (watcher_t*)watcher;
+  if (w->stopped) {
+    return;
+  }
+
+  switch (w->type) {
+    case WATCHER_FD: {
+      const uint32_t flags = ((events & EPOLLIN) ? WATCH_READ : 0) |
+                             ((events & EPOLLOUT) ? WATCH_WRITE : 0) |
+                             ((events & (EPOLLERR | EPOLLHUP)) ? WATCH_ERROR
+                                                               : 0);
+      w->cb.on_fd(w, w->fd, flags, w->arg);
+    } break;
+    case WATCHER_SIGNAL:
+      dispatch_signal(w);
+      break;
+    case WATCHER_CHILD:
+      dispatch_child(w);
+      break;
+  }
+}
@@ -0,0 +1,200 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+extern "C" {
+  #include "http_parser.h"
+  #include "http_server.h"
+}
+
+static std::string to_string(http_slice s) {
+  return std::string(s.ptr, s.len);
+}
+
+TEST(http_parser, request_head) {
+  const char req[] =
+      "POST /submit HTTP/1.1\r\n"
+      "Host: example\r\n"
+      "Content-Length:  5 \r\n"
+      "Connection: close\r\n"
+      "\r\n"
+      "hello";
+
+  uint32_t scan = 0;
+  const uint32_t head_len = http_find_head_end(req, sizeof(req) - 1, &scan);
+  ASSERT_EQ(head_len, sizeof(req) - 1 - 5);
+
+  http_request_head head;
+  ASSERT_EQ(http_parse_request_head(req, head_len, &head), 0);
+  EXPECT_EQ(to_string(head.method), "POST");
+  EXPECT_EQ(to_string(head.path), "/submit");
+  EXPECT_EQ(head.minor_version, 1);
+  EXPECT_EQ(head.header_cnt, 3u);
+  EXPECT_EQ(head.content_length, 5u);
+  EXPECT_EQ(head.keep_alive, 0);
+  EXPECT_EQ(to_string(http_find_header(&head, "HOST")), "example");
+}
+
+TEST(http_parser, incremental_head_end) {
+  const std::string req =
+      "GET /a/rather/long/path/to/cross/simd/lanes HTTP/1.1\r\n"
+      "User-Agent: socev-test\r\n\r\n";
+
+  uint32_t scan = 0;
+  for (uint32_t len = 1; len < req.size(); ++len) {
+    ASSERT_EQ(http_find_head_end(req.data(), len, &scan), 0u);
+  }
+  EXPECT_EQ(http_find_head_end(req.data(), req.size(), &scan), req.size());
+}
+
+TEST(http_parser, malformed) {
+  const char req[] = "GET\r\n\r\n";
+  http_request_head head;
+  EXPECT_EQ(http_parse_request_head(req, sizeof(req) - 1, &head), -1);
+
+  const char smuggle[] =
+      "GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n";
+  EXPECT_EQ(http_parse_request_head(smuggle, sizeof(smuggle) - 1, &head), -1);
+
+  // whitespace or other non-token bytes in a name are not stripped
+  for (const char* name : {"Transfer-Encoding ", "Transfer-Encoding\t",
+                           " Host", "Ho\"st"}) {
+    const std::string req = std::string("POST / HTTP/1.1\r\n") + name +
+                            ": chunked\r\nContent-Length: 3\r\n\r\n";
+    EXPECT_EQ(http_parse_request_head(req.data(), req.size(), &head), -1)
+        << name;
+  }
+
+  // the body length is unknown unless chunked is the last coding
+  const char gzip[] =
+      "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n";
+  EXPECT_EQ(http_parse_request_head(gzip, sizeof(gzip) - 1, &head), -1);
+
+  const char repeated[] =
+      "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+      "Transfer-Encoding: identity\r\n\r\n";
+  EXPECT_EQ(http_parse_request_head(repeated, sizeof(repeated) - 1, &head),
+            -1);
+}
+
+TEST(http_parser, encoding_and_length) {
+  const char req[] =
+      "POST / HTTP/1.1\r\nContent-Length: 4\r\n"
+      "Transfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n";
+  http_request_head head;
+  ASSERT_EQ(http_parse_request_head(req, sizeof(req) - 1, &head), 0);
+  EXPECT_EQ(head.chunked, 1);
+  EXPECT_EQ(head.content_length, 0u);
+  EXPECT_EQ(head.keep_alive, 0);
+}
+
+TEST(http_parser, chunked_in_place) {
+  std::string body = "4\r\nWiki\r\n6;ext=1\r\npedia \r\n0\r\nTrailer: x\r\n\r\n";
+  std::vector<char> buf(body.begin(), body.end());
+
+  http_chunked_decoder dec;
+  http_chunked_init(&dec);
+  uint32_t src = 0, dst = 0;
+
+  // feed it in two uneven pieces
+  ASSERT_EQ(http_chunked_decode(&dec, buf.data(), 9, &src, &dst), 0);
+  ASSERT_EQ(http_chunked_decode(&dec, buf.data(), buf.size(), &src, &dst), 1);
+  EXPECT_EQ(std::string(buf.data(), dst), "Wikipedia ");
+  EXPECT_EQ(src, buf.size());
+}
+
+TEST(http_parser, chunked_strict_framing) {
+  const char* bad[] = {
+      "\r\n",                  // empty size line is not the last chunk
+      "\r3\r\nabc\r\n0\r\n\r\n",  // no stray CR before the size
+      "3\r\r\nabc\r\n0\r\n\r\n",  // nor after it
+      "3 \r\nabc\r\n0\r\n\r\n",    // only ";ext" may follow the digits
+      "3\nabc\r\n0\r\n\r\n",        // size line without CR
+      "3\r\nabc\n0\r\n\r\n",        // bare LF after the data
+      "3\r\nabc\r\r\n0\r\n\r\n",  // repeated CR after the data
+      "3\r\nabcd\r\n0\r\n\r\n",    // more data than announced
+      "0\r\n\n",                // bare LF ending the message
+  };
+
+  for (const char* body : bad) {
+    std::vector<char> buf(body, body + strlen(body));
+    http_chunked_decoder dec;
+    http_chunked_init(&dec);
+    uint32_t src = 0, dst = 0;
+    EXPECT_EQ(http_chunked_decode(&dec, buf.data(), buf.size(), &src, &dst),
+              -1)
+        << body;
+  }
+}
+
+static std::vector<void*> g_requests;
+static std::vector<std::string> g_bodies;
+
+// the body is only valid during the callback, the handle until answered
+static void hold_request(void* req) {
+  g_requests.push_back(req);
+  g_bodies.emplace_back(http_request_get_body(req),
+                        http_request_get_body_len(req));
+}
+
+TEST(http_server, pipelined_responses_keep_order) {
+  http_server_params params = {};
+  params.port = 9010;
+  params.max_client_count = 2;
+  params.on_request = hold_request;
+
+  void* server = http_server_create(params);
+  ASSERT_NE(server, nullptr);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(9010);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+
+  const std::string reqs =
+      "GET /1 HTTP/1.1\r\n\r\n"
+      "POST /2 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n"
+      "GET /3 HTTP/1.1\r\n\r\n";
+  ASSERT_EQ(write(fd, reqs.data(), reqs.size()), (ssize_t)reqs.size());
+
+  while (g_requests.size() < 3) {
+    http_server_service(server, 1000);
+  }
+  EXPECT_EQ(g_bodies[1], "abc");
+
+  // answer in reverse, the wire order must still follow the requests
+  http_respond(g_requests[2], 200, NULL, "three", 5);
+  http_respond_chunked_begin(g_requests[1], 200, "X-Seq: 2\r\n");
+  http_respond_chunk(g_requests[1], "two", 3);
+  http_respond_chunked_end(g_requests[1]);
+  http_respond(g_requests[0], 204, NULL, "one", 3);
+  http_server_service(server, 0);
+
+  // a 204 gets neither a length nor the body
+  const std::string expected =
+      "HTTP/1.1 204 No Content\r\n\r\n"
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nX-Seq: 2\r\n\r\n"
+      "3\r\ntwo\r\n0\r\n\r\n"
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nthree";
+  std::string got;
+  while (got.size() < expected.size()) {
+    char buf[512];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    got.append(buf, n);
+  }
+  EXPECT_EQ(got, expected);
+
+  close(fd);
+  http_server_destroy(server);
+}
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,7 +1,44 @@
+#include <arpa/inet.h>
 #include <gtest/gtest.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
 extern "C" {
+  #include "client.h"
+  #include "epoll_helper.h"
+  #include "log.h"
+  #include "replay.h"
+  #include "shm_link.h"
   #include "tcp_context.h"
+  #include "utils.h"
+}
+
+static int connect_loopback(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
 }
+
 TEST(tcp_context, create_destroy) {
   tcp_context_params params = {
     .port = 9000,
@@ -15,7 +52,1146 @@ TEST(tcp_context, create_destroy) {
   tcp_context_destroy(ctx);
 }
 
+// OPT_PIN_CPU pins the calling thread, the tests after this one must run
+// with the affinity they started with
+struct affinity_guard {
+  cpu_set_t mask;
+  affinity_guard() { sched_getaffinity(0, sizeof(mask), &mask); }
+  ~affinity_guard() { sched_setaffinity(0, sizeof(mask), &mask); }
+};
+
+TEST(tcp_context, pin_and_steer) {
+  affinity_guard guard;
+  tcp_context_params params = {
+    .port = 9001,
+    .max_client_count = 2,
+    .callback = [](const event_type ev, void *c_info, const void *in,
+                   const unsigned int len){},
+    .options = OPT_PIN_CPU | OPT_STEER_INCOMING_CPU,
+    .cpu = 0
+  };
+
+  auto ctx = tcp_context_create(params);
+  ASSERT_NE(ctx, nullptr);
+  EXPECT_EQ(sched_getcpu(), 0);
+
+  // a second loop may join the same reuseport group
+  auto peer = tcp_context_create(params);
+  ASSERT_NE(peer, nullptr);
+  tcp_context_destroy(peer);
+
+  int fd = connect_loopback(9001);
+  ASSERT_NE(fd, -1);
+  EXPECT_GT(tcp_context_service(ctx, 1000), 0);
+
+  tcp_context_stats stats;
+  ASSERT_EQ(tcp_context_get_stats(ctx, &stats), 0);
+  EXPECT_EQ(stats.cpu, 0);
+  EXPECT_EQ(stats.flows, 1u);
+  EXPECT_EQ(stats.flows_local + stats.flows_remote, 1u);
+
+  close(fd);
+  tcp_context_destroy(ctx);
+}
+
+TEST(tcp_context, trace_dump) {
+  tcp_context_params params = {
+    .port = 9002,
+    .max_client_count = 2,
+    .callback = [](const event_type ev, void *c_info, const void *in,
+                   const unsigned int len){}
+  };
+
+  auto ctx = tcp_context_create(params);
+  ASSERT_NE(ctx, nullptr);
+  ASSERT_EQ(tcp_context_trace_enable(ctx, 64), 0);
+
+  int fd = connect_loopback(9002);
+  ASSERT_NE(fd, -1);
+  EXPECT_GT(tcp_context_service(ctx, 1000), 0);
+
+  const char* path = "socev_trace_test.json";
+  tcp_context_trace_request_dump(ctx, path);
+  tcp_context_service(ctx, 0);
+
+  std::ifstream in(path);
+  std::string json((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  EXPECT_NE(json.find("\"traceEvents\""), std::string::npos);
+  EXPECT_NE(json.find("\"epoll_wait\""), std::string::npos);
+  EXPECT_NE(json.find("\"accept\""), std::string::npos);
+  remove(path);
+
+  close(fd);
+  tcp_context_destroy(ctx);
+}
+
+static void* g_ctx;
+static int g_slow_events;
+static int g_disconnects;
+
+static void group_callback(const event_type ev, void* c_info, const void* in,
+                           const unsigned int len) {
+  if (ev == EVT_CLIENT_CONNECTED) {
+    tcp_context_group_join(g_ctx, "feed", c_info);
+  } else if (ev == EVT_CLIENT_SLOW) {
+    g_slow_events++;
+  } else if (ev == EVT_CLIENT_DISCONNECTED) {
+    g_disconnects++;
+  }
+}
+
+TEST(tcp_context, broadcast) {
+  tcp_context_params params = {
+    .port = 9003,
+    .max_client_count = 4,
+    .callback = group_callback
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+
+  int fds[3];
+  for (int& fd : fds) {
+    fd = connect_loopback(9003);
+    ASSERT_NE(fd, -1);
+  }
+  while (tcp_context_group_count(g_ctx, "feed") < 3) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  // an empty broadcast queues nothing and must not stall the flush
+  EXPECT_EQ(tcp_context_broadcast(g_ctx, "feed", "", 0), 0);
+  EXPECT_EQ(tcp_context_broadcast(g_ctx, "feed", "tick", 4), 3);
+  tcp_context_service(g_ctx, 0);
+
+  for (int fd : fds) {
+    char buf[8] = {};
+    ASSERT_EQ(recv(fd, buf, sizeof(buf), 0), 4);
+    EXPECT_STREQ(buf, "tick");
+  }
+
+  // removed clients leave their groups
+  close(fds[0]);
+  while (tcp_context_group_count(g_ctx, "feed") != 2) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  close(fds[1]);
+  close(fds[2]);
+  tcp_context_destroy(g_ctx);
+}
+
+TEST(tcp_context, drop_slow_client) {
+  tcp_context_params params = {
+    .port = 9004,
+    .max_client_count = 2,
+    .callback = group_callback,
+    .options = OPT_DROP_SLOW_CLIENTS,
+    .cpu = 0,
+    .max_queued_bytes = 64 * 1024
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_slow_events = 0;
+  g_disconnects = 0;
+
+  // never reads, so the kernel buffers fill and the queue grows
+  int fd = connect_loopback(9004);
+  ASSERT_NE(fd, -1);
+  while (tcp_context_group_count(g_ctx, "feed") < 1) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  std::string chunk(16 * 1024, 'x');
+  for (int i = 0; i < 1024 && g_disconnects == 0; ++i) {
+    tcp_context_broadcast(g_ctx, "feed", chunk.data(), chunk.size());
+    tcp_context_service(g_ctx, 0);
+  }
+
+  EXPECT_EQ(g_slow_events, 1);
+  EXPECT_EQ(g_disconnects, 1);
+  EXPECT_EQ(tcp_context_group_count(g_ctx, "feed"), 0u);
+
+  close(fd);
+  tcp_context_destroy(g_ctx);
+}
+
+TEST(tcp_context, reap_closing_client) {
+  tcp_context_params params = {
+    .port = 9019,
+    .max_client_count = 2,
+    .callback = group_callback
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_disconnects = 0;
+
+  int fd = connect_loopback(9019);
+  ASSERT_NE(fd, -1);
+  while (tcp_context_group_count(g_ctx, "feed") < 1) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  // more than the socket buffers hold, then the peer hangs up its side
+  std::string chunk(64 * 1024, 'x');
+  for (int i = 0; i < 256; ++i) {
+    tcp_context_broadcast(g_ctx, "feed", chunk.data(), chunk.size());
+  }
+  tcp_context_service(g_ctx, 0);
+  shutdown(fd, SHUT_WR);
+  for (int i = 0; i < 5; ++i) {
+    tcp_context_service(g_ctx, 10);
+  }
+  EXPECT_EQ(g_disconnects, 0);
+
+  // the closing client still belongs to the group, so the batched group
+  // flush may be the one that empties its queue
+  char buf[64 * 1024];
+  for (int i = 0; i < 1000 && !g_disconnects; ++i) {
+    while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+    tcp_context_broadcast(g_ctx, "feed", "tick", 4);
+    tcp_context_service(g_ctx, 1);
+  }
+  EXPECT_EQ(g_disconnects, 1);
+
+  close(fd);
+  tcp_context_destroy(g_ctx);
+}
+
+static void* g_accepted;
+static int g_timer_events;
+
+static void accept_callback(const event_type ev, void* c_info, const void* in,
+                            const unsigned int len) {
+  if (ev == EVT_CLIENT_CONNECTED) {
+    g_accepted = c_info;
+  } else if (ev == EVT_CLIENT_TIMER_EXPIRED) {
+    g_timer_events++;
+  }
+}
+
+TEST(tcp_context, close_keeps_user_timer) {
+  tcp_context_params params = {
+    .port = 9021,
+    .max_client_count = 2,
+    .callback = accept_callback
+  };
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_accepted = nullptr;
+  g_timer_events = 0;
+
+  int fd = connect_loopback(9021);
+  ASSERT_NE(fd, -1);
+  while (!g_accepted) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  // output the peer never reads keeps the closing client around
+  std::string chunk(16 * 1024, 'x');
+  while (!client_has_pending_output(g_accepted)) {
+    ASSERT_EQ(client_write_zerocopy(g_accepted, chunk.data(), chunk.size()), 1);
+  }
+  client_set_timer(g_accepted, 20 * 1000);
+  client_enable_timer(g_accepted, 1);
+  client_close(g_accepted);
+
+  for (int i = 0; i < 20 && !g_timer_events; ++i) {
+    tcp_context_service(g_ctx, 10);
+  }
+  EXPECT_EQ(g_timer_events, 1);
+
+  close(fd);
+  tcp_context_destroy(g_ctx);
+}
+
+TEST(tcp_context, write_keeps_queue_order) {
+  tcp_context_params params = {
+    .port = 9018,
+    .max_client_count = 2,
+    .callback = accept_callback
+  };
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_accepted = nullptr;
+
+  int fd = connect_loopback(9018);
+  ASSERT_NE(fd, -1);
+  while (!g_accepted) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  // fill the socket until the rest of a chunk waits in the queue
+  std::string chunk(16 * 1024, 'x');
+  size_t total = 0;
+  while (!client_has_pending_output(g_accepted)) {
+    ASSERT_EQ(client_write_zerocopy(g_accepted, chunk.data(), chunk.size()), 1);
+    total += chunk.size();
+  }
+  EXPECT_EQ(client_write(g_accepted, "tail", 4), 4);
+  total += 4;
+
+  std::string got;
+  char buf[64 * 1024];
+  for (int i = 0; i < 1000 && got.size() < total; ++i) {
+    tcp_context_service(g_ctx, 1);
+    const ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      got.append(buf, n);
+    }
+  }
+  EXPECT_EQ(got.size(), total);
+  EXPECT_EQ(got.substr(got.size() - 4), "tail");
+  EXPECT_EQ(got.find('t'), got.size() - 4);
+
+  close(fd);
+  tcp_context_destroy(g_ctx);
+}
+
+static std::vector<void*> g_members;
+
+// the first slow member throws every other one out of the group while the
+// broadcast is still walking it
+static void evict_callback(const event_type ev, void* c_info, const void* in,
+                           const unsigned int len) {
+  if (ev == EVT_CLIENT_CONNECTED) {
+    tcp_context_group_join(g_ctx, "feed", c_info);
+    g_members.push_back(c_info);
+  } else if (ev == EVT_CLIENT_SLOW) {
+    if (g_slow_events++ == 0) {
+      for (void* member : g_members) {
+        if (member != c_info) {
+          tcp_context_group_leave(g_ctx, "feed", member);
+        }
+      }
+    }
+  }
+}
+
+TEST(tcp_context, group_members_leave_during_broadcast) {
+  tcp_context_params params = {
+    .port = 9020,
+    .max_client_count = 4,
+    .callback = evict_callback,
+    .options = 0,
+    .cpu = 0,
+    .max_queued_bytes = 1
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_members.clear();
+  g_slow_events = 0;
+
+  int fds[3];
+  for (int& fd : fds) {
+    fd = connect_loopback(9020);
+    ASSERT_NE(fd, -1);
+  }
+  while (tcp_context_group_count(g_ctx, "feed") < 3) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  EXPECT_EQ(tcp_context_broadcast(g_ctx, "feed", "tick", 4), 1);
+  EXPECT_EQ(g_slow_events, 1);
+  EXPECT_EQ(tcp_context_group_count(g_ctx, "feed"), 1u);
+  tcp_context_service(g_ctx, 0);
+
+  // the survivor can still leave and the group empties cleanly
+  for (void* member : g_members) {
+    tcp_context_group_leave(g_ctx, "feed", member);
+  }
+  EXPECT_EQ(tcp_context_group_count(g_ctx, "feed"), 0u);
+
+  for (int fd : fds) {
+    close(fd);
+  }
+  tcp_context_destroy(g_ctx);
+}
+
+static int g_connects;
+static int g_data_events;
+static uint16_t g_upstream_port = 9006;
+
+static void proxy_callback(const event_type ev, void* c_info, const void* in,
+                           const unsigned int len) {
+  if (ev == EVT_CLIENT_CONNECTED) {
+    g_connects++;
+    // accepted side, open the upstream and pair them
+    if (!client_get_user_data(c_info)) {
+      void* upstream =
+          tcp_context_connect(g_ctx, "127.0.0.1", g_upstream_port);
+      ASSERT_NE(upstream, nullptr);
+      client_set_user_data(c_info, upstream);
+      client_set_user_data(upstream, c_info);
+      ASSERT_EQ(tcp_context_proxy(g_ctx, c_info, upstream), 0);
+    }
+  } else if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    g_data_events++;
+  } else if (ev == EVT_CLIENT_DISCONNECTED) {
+    g_disconnects++;
+  }
+}
+
+TEST(tcp_context, splice_proxy) {
+  int upstream = socket(AF_INET, SOCK_STREAM, 0);
+  const int one = 1;
+  setsockopt(upstream, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(9006);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(upstream, (struct sockaddr*)&addr, sizeof(addr)), 0);
+  ASSERT_EQ(listen(upstream, 1), 0);
+
+  tcp_context_params params = {
+    .port = 9005,
+    .max_client_count = 4,
+    .callback = proxy_callback
+  };
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_connects = g_data_events = g_disconnects = 0;
+
+  int fd = connect_loopback(9005);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(write(fd, "ping", 4), 4);
+  while (g_connects < 2) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  int peer = accept(upstream, NULL, NULL);
+  ASSERT_NE(peer, -1);
+  char buf[8] = {};
+  while (recv(peer, buf, sizeof(buf), MSG_DONTWAIT) != 4) {
+    tcp_context_service(g_ctx, 10);
+  }
+  EXPECT_STREQ(buf, "ping");
+
+  // the upstream half-close travels to the client
+  ASSERT_EQ(write(peer, "pong", 4), 4);
+  shutdown(peer, SHUT_WR);
+  memset(buf, 0, sizeof(buf));
+  std::string got;
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+    if (n > 0) {
+      got.append(buf, n);
+    }
+    tcp_context_service(g_ctx, 10);
+  }
+  EXPECT_EQ(got, "pong");
+
+  close(fd);
+  while (g_disconnects < 2) {
+    tcp_context_service(g_ctx, 1000);
+  }
+  EXPECT_EQ(g_data_events, 0);
+
+  close(peer);
+  close(upstream);
+  tcp_context_destroy(g_ctx);
+}
+
+TEST(tcp_context, proxy_waits_for_upstream_connect) {
+  // a full accept queue drops the proxy's syn, its connect stays pending
+  int upstream = socket(AF_INET, SOCK_STREAM, 0);
+  const int one = 1;
+  setsockopt(upstream, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(9016);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(upstream, (struct sockaddr*)&addr, sizeof(addr)), 0);
+  ASSERT_EQ(listen(upstream, 0), 0);
+  int filler = connect_loopback(9016);
+  ASSERT_NE(filler, -1);
+
+  tcp_context_params params = {
+    .port = 9017,
+    .max_client_count = 4,
+    .callback = proxy_callback
+  };
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_connects = g_data_events = g_disconnects = 0;
+  g_upstream_port = 9016;
+
+  int fd = connect_loopback(9017);
+  ASSERT_NE(fd, -1);
+  ASSERT_EQ(write(fd, "ping", 4), 4);
+  while (g_connects < 1) {
+    tcp_context_service(g_ctx, 1000);
+  }
+
+  // unread input on the accepted side must not wake the loop meanwhile
+  int wakeups = 0;
+  for (int i = 0; i < 10; ++i) {
+    if (tcp_context_service(g_ctx, 20) > 0) {
+      wakeups++;
+    }
+  }
+  EXPECT_LE(wakeups, 1);
+  EXPECT_EQ(g_connects, 1);
+
+  g_upstream_port = 9006;
+  close(fd);
+  tcp_context_destroy(g_ctx);
+  close(filler);
+  close(upstream);
+}
+
+static std::vector<int> g_tasks;
+
+static void record_task(void* arg) {
+  g_tasks.push_back((int)(intptr_t)arg);
+}
+
+static void slow_task(void* arg) {
+  usleep(2000);
+  record_task(arg);
+}
+
+static void requeue_task(void* arg) {
+  record_task(arg);
+  tcp_context_defer(g_ctx, record_task, (void*)((intptr_t)arg + 1));
+}
+
+TEST(tcp_context, deferred_and_idle_tasks) {
+  tcp_context_params params = {
+    .port = 9007,
+    .max_client_count = 2,
+    .callback = [](const event_type ev, void *c_info, const void *in,
+                   const unsigned int len){},
+    .task_budget_us = 1000
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+  g_tasks.clear();
+
+  // idle tasks wait for the deferred ones, pending tasks never block
+  ASSERT_EQ(tcp_context_idle(g_ctx, record_task, (void*)100), 0);
+  ASSERT_EQ(tcp_context_defer(g_ctx, requeue_task, (void*)1), 0);
+  ASSERT_EQ(tcp_context_defer(g_ctx, record_task, (void*)3), 0);
+  EXPECT_EQ(tcp_context_pending_tasks(g_ctx), 3u);
+
+  EXPECT_EQ(tcp_context_service(g_ctx, 10000), 0);
+  EXPECT_EQ(g_tasks, std::vector<int>({1, 3}));
+
+  EXPECT_EQ(tcp_context_service(g_ctx, 10000), 0);
+  EXPECT_EQ(g_tasks, std::vector<int>({1, 3, 2, 100}));
+  EXPECT_EQ(tcp_context_pending_tasks(g_ctx), 0u);
+
+  // tasks over the budget roll over, one at a time here
+  g_tasks.clear();
+  for (intptr_t i = 0; i < 3; ++i) {
+    tcp_context_defer(g_ctx, slow_task, (void*)i);
+  }
+  tcp_context_service(g_ctx, 0);
+  EXPECT_EQ(g_tasks.size(), 1u);
+  tcp_context_service(g_ctx, 0);
+  tcp_context_service(g_ctx, 0);
+  EXPECT_EQ(g_tasks, std::vector<int>({0, 1, 2}));
+
+  tcp_context_destroy(g_ctx);
+  g_ctx = nullptr;
+}
+
+static std::vector<uint32_t> g_fd_events;
+static int g_signo;
+static int g_child_status = -1;
+
+TEST(tcp_context, watchers) {
+  tcp_context_params params = {
+    .port = 9008,
+    .max_client_count = 2,
+    .callback = [](const event_type ev, void *c_info, const void *in,
+                   const unsigned int len){}
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+
+  // plain fd, the writable end unwatches itself from its callback
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  void* rd = tcp_context_watch_fd(g_ctx, fds[0], WATCH_READ,
+      [](void* w, int fd, uint32_t events, void* arg) {
+        char c;
+        EXPECT_EQ(read(fd, &c, 1), 1);
+        g_fd_events.push_back(events);
+      }, nullptr);
+  void* wr = tcp_context_watch_fd(g_ctx, fds[1], WATCH_WRITE,
+      [](void* w, int fd, uint32_t events, void* arg) {
+        EXPECT_EQ(write(fd, "x", 1), 1);
+        g_fd_events.push_back(events);
+        tcp_context_unwatch(g_ctx, w);
+      }, nullptr);
+  ASSERT_NE(rd, nullptr);
+  ASSERT_NE(wr, nullptr);
+
+  for (int i = 0; i < 3 && g_fd_events.size() < 2; ++i) {
+    tcp_context_service(g_ctx, 1000);
+  }
+  EXPECT_EQ(g_fd_events, std::vector<uint32_t>({WATCH_WRITE, WATCH_READ}));
+
+  // signals are read from a signalfd instead of interrupting the thread
+  void* sig = tcp_context_watch_signal(g_ctx, SIGUSR1,
+      [](void* w, int signo, void* arg) { g_signo = signo; }, nullptr);
+  ASSERT_NE(sig, nullptr);
+  raise(SIGUSR1);
+  EXPECT_EQ(tcp_context_service(g_ctx, 1000), 1);
+  EXPECT_EQ(g_signo, SIGUSR1);
+  tcp_context_unwatch(g_ctx, sig);
+
+  // the child is reaped by the loop
+  pid_t pid = fork();
+  ASSERT_NE(pid, -1);
+  if (pid == 0) {
+    _exit(3);
+  }
+  ASSERT_NE(tcp_context_watch_child(g_ctx, pid,
+      [](void* w, pid_t pid, int status, void* arg) {
+        g_child_status = status;
+      }, nullptr), nullptr);
+  for (int i = 0; i < 10 && g_child_status == -1; ++i) {
+    tcp_context_service(g_ctx, 1000);
+  }
+  ASSERT_TRUE(WIFEXITED(g_child_status));
+  EXPECT_EQ(WEXITSTATUS(g_child_status), 3);
+
+  tcp_context_unwatch(g_ctx, rd);
+  tcp_context_destroy(g_ctx);
+  g_ctx = nullptr;
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// self-signed P-256 certificate for the loopback tls tests
+static void write_test_cert(const char* cert_path, const char* key_path) {
+  EVP_PKEY* key = EVP_EC_gen("P-256");
+  X509* x509 = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+  X509_set_pubkey(x509, key);
+  X509_NAME* name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  X509_sign(x509, key, EVP_sha256());
+
+  FILE* f = fopen(cert_path, "w");
+  PEM_write_X509(f, x509);
+  fclose(f);
+  f = fopen(key_path, "w");
+  PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+  fclose(f);
+
+  X509_free(x509);
+  EVP_PKEY_free(key);
+}
+
+static int g_file_fd = -1;
+static off_t g_file_off;
+static off_t g_file_len;
+
+static void send_file(void* client) {
+  while (g_file_off < g_file_len) {
+    if (client_sendfile(client, g_file_fd, &g_file_off,
+                        g_file_len - g_file_off) <= 0) {
+      client_callback_on_writable(client);
+      return;
+    }
+  }
+}
+
+static void tls_callback(const event_type ev, void* c_info, const void* in,
+                         const uint32_t len) {
+  if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    // echo, then the file behind it
+    EXPECT_EQ(client_write(c_info, in, len), (int)len);
+    send_file(c_info);
+  } else if (ev == EVT_CLIENT_WRITABLE) {
+    send_file(c_info);
+  } else if (ev == EVT_CLIENT_DISCONNECTED) {
+    g_disconnects++;
+  }
+}
+
+TEST(tcp_context, tls_echo_and_sendfile) {
+  write_test_cert("/tmp/socev_test_cert.pem", "/tmp/socev_test_key.pem");
+
+  std::string file(300 * 1024, '\0');
+  for (size_t i = 0; i < file.size(); ++i) {
+    file[i] = (char)(i * 7);
+  }
+  FILE* f = tmpfile();
+  fwrite(file.data(), 1, file.size(), f);
+  fflush(f);
+  g_file_fd = fileno(f);
+  g_file_off = 0;
+  g_file_len = file.size();
+  g_disconnects = 0;
+
+  tcp_context_params params = {
+    .port = 9009,
+    .max_client_count = 2,
+    .callback = tls_callback,
+    .tls_cert_file = "/tmp/socev_test_cert.pem",
+    .tls_key_file = "/tmp/socev_test_key.pem"
+  };
+
+  g_ctx = tcp_context_create(params);
+  ASSERT_NE(g_ctx, nullptr);
+
+  std::string received;
+  std::thread peer([&received] {
+    SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_client_method());
+    SSL* ssl = SSL_new(ssl_ctx);
+    int fd = connect_loopback(9009);
+    SSL_set_fd(ssl, fd);
+    if (SSL_connect(ssl) == 1) {
+      SSL_write(ssl, "ping", 4);
+      char buf[16 * 1024];
+      int n;
+      while (received.size() < 4 + 300 * 1024 &&
+             (n = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+        received.append(buf, n);
+      }
+      SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    SSL_CTX_free(ssl_ctx);
+    close(fd);
+  });
+
+  for (int i = 0; i < 1000 && !g_disconnects; ++i) {
+    tcp_context_service(g_ctx, 100);
+  }
+  peer.join();
+
+  EXPECT_EQ(g_disconnects, 1);
+  ASSERT_EQ(received.size(), 4 + file.size());
+  EXPECT_EQ(received.substr(0, 4), "ping");
+  EXPECT_TRUE(received.compare(4, file.size(), file) == 0);
+
+  tcp_context_stats stats;
+  ASSERT_EQ(tcp_context_get_stats(g_ctx, &stats), 0);
+  EXPECT_EQ(stats.tls_handshakes, 1u);
+
+  tcp_context_destroy(g_ctx);
+  g_ctx = nullptr;
+  fclose(f);
+  unlink("/tmp/socev_test_cert.pem");
+  unlink("/tmp/socev_test_key.pem");
+}
+
+static std::vector<std::pair<int, std::string>> g_replayed;
+
+static void record_event(const event_type ev, void* c_info, const void* in,
+                         const uint32_t len) {
+  g_replayed.emplace_back(ev, std::string((const char*)in, len));
+  if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    // handlers keep using the client api during a replay
+    EXPECT_EQ(client_write(c_info, in, len), (int)len);
+    EXPECT_STREQ(client_get_ip(c_info), "127.0.0.1");
+  }
+}
+
+TEST(tcp_context, capture_and_replay) {
+  const char* path = "/tmp/socev_test_capture.bin";
+  tcp_context_params params = {
+    .port = 9012,
+    .max_client_count = 2,
+    .callback = [](const event_type ev, void *c_info, const void *in,
+                   const unsigned int len){}
+  };
+
+  auto ctx = tcp_context_create(params);
+  ASSERT_NE(ctx, nullptr);
+  ASSERT_EQ(tcp_context_capture_start(ctx, path), 0);
+
+  int fd = connect_loopback(9012);
+  ASSERT_NE(fd, -1);
+  tcp_context_service(ctx, 1000);
+  ASSERT_EQ(write(fd, "hello", 5), 5);
+  tcp_context_service(ctx, 1000);
+  usleep(20000);
+  ASSERT_EQ(write(fd, "world!", 6), 6);
+  tcp_context_service(ctx, 1000);
+  close(fd);
+  tcp_context_service(ctx, 1000);
+  tcp_context_capture_stop(ctx);
+  tcp_context_destroy(ctx);
+
+  const std::vector<std::pair<int, std::string>> expected = {
+      {EVT_CLIENT_CONNECTED, ""},
+      {EVT_CLIENT_DATA_RECEIVED, "hello"},
+      {EVT_CLIENT_DATA_RECEIVED, "world!"},
+      {EVT_CLIENT_DISCONNECTED, ""}};
+
+  replay_stats stats;
+  g_replayed.clear();
+  ASSERT_EQ(replay_run(path, record_event, REPLAY_FAST, &stats), 0);
+  EXPECT_EQ(g_replayed, expected);
+  EXPECT_EQ(stats.events, 4u);
+  EXPECT_EQ(stats.data_events, 2u);
+  EXPECT_EQ(stats.bytes, 11u);
+  EXPECT_EQ(stats.connections, 1u);
+  EXPECT_LE(stats.latency_p50_ns, stats.latency_max_ns);
+
+  // recorded timing keeps the gap between the two chunks
+  g_replayed.clear();
+  ASSERT_EQ(replay_run(path, record_event, REPLAY_REALTIME, &stats), 0);
+  EXPECT_EQ(g_replayed, expected);
+  EXPECT_GE(stats.elapsed_ns, 20000000u);
+
+  unlink(path);
+}
+
+static std::vector<char> g_zc_buf(256 * 1024, 'z');
+static std::vector<std::pair<const void*, uint32_t>> g_completed;
+static int g_zc_result = -1;
+
+static void zerocopy_callback(const event_type ev, void* c_info,
+                              const void* in, const uint32_t len) {
+  if (ev == EVT_CLIENT_CONNECTED) {
+    // below the threshold the data is copied and free right away
+    EXPECT_EQ(client_write_zerocopy(c_info, "small", 5), 1);
+    g_zc_result = client_write_zerocopy(c_info, g_zc_buf.data(),
+                                        g_zc_buf.size());
+  } else if (ev == EVT_CLIENT_SEND_COMPLETE) {
+    g_completed.emplace_back(in, len);
+  }
+}
+
+TEST(tcp_context, zerocopy_send) {
+  tcp_context_params params = {
+    .port = 9013,
+    .max_client_count = 2,
+    .callback = zerocopy_callback,
+    .zerocopy_threshold = 64 * 1024
+  };
+
+  auto ctx = tcp_context_create(params);
+  ASSERT_NE(ctx, nullptr);
+  g_completed.clear();
+
+  int fd = connect_loopback(9013);
+  ASSERT_NE(fd, -1);
+
+  const size_t total = 5 + g_zc_buf.size();
+  std::string received;
+  char buf[64 * 1024];
+  for (int i = 0; i < 1000 && received.size() < total; ++i) {
+    tcp_context_service(ctx, 10);
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      received.append(buf, n);
+    }
+  }
+  ASSERT_EQ(received.size(), total);
+  EXPECT_EQ(received.substr(0, 5), "small");
+  EXPECT_EQ(received.substr(5), std::string(g_zc_buf.begin(), g_zc_buf.end()));
+
+  // a pinned buffer comes back once the kernel let go of it
+  ASSERT_NE(g_zc_result, -1);
+  if (g_zc_result == 0) {
+    for (int i = 0; i < 100 && g_completed.empty(); ++i) {
+      tcp_context_service(ctx, 10);
+    }
+    ASSERT_EQ(g_completed.size(), 1u);
+    EXPECT_EQ(g_completed[0].first, g_zc_buf.data());
+    EXPECT_EQ(g_completed[0].second, g_zc_buf.size());
+
+    tcp_context_stats stats;
+    tcp_context_get_stats(ctx, &stats);
+    EXPECT_GT(stats.zerocopy_reports, 0u);
+  }
+
+  close(fd);
+  tcp_context_destroy(ctx);
+}
+
+static std::string g_shm_received;
+static int g_shm_events[__EVT_MAX_COUNT];
+
+static void shm_echo_callback(const event_type ev, void* c_info, const void* in,
+                              const uint32_t len) {
+  if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    EXPECT_EQ(client_write(c_info, in, len), (int)len);
+  }
+}
+
+static void shm_peer_callback(const event_type ev, void* c_info, const void* in,
+                              const uint32_t len) {
+  g_shm_events[ev]++;
+  if (ev == EVT_CLIENT_DATA_RECEIVED) {
+    g_shm_received.append((const char*)in, len);
+  }
+}
+
+TEST(tcp_context, shm_link_echo) {
+  const char* path = "/tmp/socev_shm_test.sock";
+  tcp_context_params server_params = {
+    .port = 9014,
+    .max_client_count = 2,
+    .callback = shm_echo_callback,
+    .shm_path = path
+  };
+  // a small ring makes both sides queue and wait for space
+  tcp_context_params peer_params = {
+    .port = 9015,
+    .max_client_count = 2,
+    .callback = shm_peer_callback,
+    .shm_ring_size = 4096
+  };
+
+  auto server = tcp_context_create(server_params);
+  ASSERT_NE(server, nullptr);
+  auto peer = tcp_context_create(peer_params);
+  ASSERT_NE(peer, nullptr);
+  g_shm_received.clear();
+  memset(g_shm_events, 0, sizeof(g_shm_events));
+
+  void* client = tcp_context_connect_shm(peer, path);
+  ASSERT_NE(client, nullptr);
+
+  std::string sent;
+  for (int i = 0; sent.size() < 64 * 1024; ++i) {
+    sent += "line " + std::to_string(i) + "\n";
+  }
+  EXPECT_EQ(client_write(client, sent.data(), sent.size()), (int)sent.size());
+
+  for (int i = 0; i < 10000 && g_shm_received.size() < sent.size(); ++i) {
+    tcp_context_service(server, 0);
+    tcp_context_service(peer, 0);
+  }
+  EXPECT_EQ(g_shm_events[EVT_CLIENT_CONNECTED], 1);
+  EXPECT_EQ(g_shm_received, sent);
+
+  tcp_context_stats stats;
+  tcp_context_get_stats(server, &stats);
+  EXPECT_EQ(stats.shm_links, 1u);
+
+  // closing one side reaches the other through the socket
+  client_close(client);
+  for (int i = 0; i < 100 && !g_shm_events[EVT_CLIENT_DISCONNECTED]; ++i) {
+    tcp_context_service(peer, 0);
+    tcp_context_service(server, 0);
+  }
+  EXPECT_EQ(g_shm_events[EVT_CLIENT_DISCONNECTED], 1);
+
+  tcp_context_destroy(peer);
+  tcp_context_destroy(server);
+  EXPECT_NE(access(path, F_OK), 0);
+}
+
+// the header and the memfd come from the peer, attach must reject anything
+// that would let ring offsets leave the mapping
+static int connect_unix(const char* path) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// true once the context closed its end of fd
+static bool peer_closed(int fd) {
+  char byte;
+  return recv(fd, &byte, 1, MSG_DONTWAIT) == 0;
+}
+
+TEST(tcp_context, shm_silent_peers_are_bounded) {
+  const char* path = "/tmp/socev_shm_silent.sock";
+  tcp_context_params params = {
+    .port = 9022,
+    .max_client_count = 1,
+    .callback = accept_callback,
+    .shm_path = path
+  };
+  auto ctx = tcp_context_create(params);
+  ASSERT_NE(ctx, nullptr);
+
+  // the first peer never sends its link and takes the only slot meanwhile
+  int silent = connect_unix(path);
+  ASSERT_NE(silent, -1);
+  tcp_context_service(ctx, 100);
+  int extra = connect_unix(path);
+  ASSERT_NE(extra, -1);
+  for (int i = 0; i < 10 && !peer_closed(extra); ++i) {
+    tcp_context_service(ctx, 10);
+  }
+  EXPECT_TRUE(peer_closed(extra));
+  EXPECT_FALSE(peer_closed(silent));
+
+  // and is dropped once the wait for its link ran out
+  for (int i = 0; i < 30 && !peer_closed(silent); ++i) {
+    tcp_context_service(ctx, 100);
+  }
+  EXPECT_TRUE(peer_closed(silent));
+
+  close(extra);
+  close(silent);
+  tcp_context_destroy(ctx);
+}
+
+TEST(shm_link, attach_rejects_bad_memfd) {
+  int fds[SHM_LINK_FDS];
+  void* link = shm_link_create(4096, fds);
+  ASSERT_NE(link, nullptr);
+  const int good[SHM_LINK_FDS] = {dup(fds[0]), dup(fds[1]), dup(fds[2])};
+  void* peer = shm_link_attach(good);
+  ASSERT_NE(peer, nullptr);
+  EXPECT_EQ(shm_link_write(link, "ping", 4), 4u);
+  const void* data;
+  EXPECT_EQ(shm_link_peek(peer, &data), 4u);
+  shm_link_destroy(peer);
+
+  char header[4096];
+  ASSERT_EQ(pread(fds[0], header, sizeof(header), 0), (ssize_t)sizeof(header));
+  for (uint32_t ring_size : {0u, 5000u, 1u << 20}) {
+    int memfd = memfd_create("bad", MFD_ALLOW_SEALING);
+    ASSERT_NE(memfd, -1);
+    memcpy(header + 8, &ring_size, sizeof(ring_size));
+    ASSERT_EQ(pwrite(memfd, header, sizeof(header), 0),
+              (ssize_t)sizeof(header));
+    ASSERT_EQ(ftruncate(memfd, 4096 + 2 * 4096), 0);
+    const int bad[SHM_LINK_FDS] = {memfd, eventfd(0, 0), eventfd(0, 0)};
+    EXPECT_EQ(shm_link_attach(bad), nullptr);
+  }
+
+  // a right sized but unsealed memfd could still shrink under the mapping
+  int memfd = memfd_create("unsealed", 0);
+  ASSERT_EQ(pwrite(memfd, header, sizeof(header), 0), (ssize_t)sizeof(header));
+  uint32_t ring_size = 4096;
+  ASSERT_EQ(pwrite(memfd, &ring_size, sizeof(ring_size), 8), 4);
+  ASSERT_EQ(ftruncate(memfd, 4096 + 2 * 4096), 0);
+  const int unsealed[SHM_LINK_FDS] = {memfd, eventfd(0, 0), eventfd(0, 0)};
+  EXPECT_EQ(shm_link_attach(unsealed), nullptr);
+
+  // a regular file has no seals at all and could be truncated at will
+  char path[] = "/tmp/socev_shm_file_XXXXXX";
+  int file = mkstemp(path);
+  ASSERT_NE(file, -1);
+  unlink(path);
+  ASSERT_EQ(pwrite(file, header, sizeof(header), 0), (ssize_t)sizeof(header));
+  ASSERT_EQ(pwrite(file, &ring_size, sizeof(ring_size), 8), 4);
+  ASSERT_EQ(ftruncate(file, 4096 + 2 * 4096), 0);
+  const int regular[SHM_LINK_FDS] = {file, eventfd(0, 0), eventfd(0, 0)};
+  EXPECT_EQ(shm_link_attach(regular), nullptr);
+
+  shm_link_destroy(link);
+  // the rejections above are logged without a loop to flush them
+  log_flush();
+}
+
+TEST(utils, recv_fds_closes_unexpected_fds) {
+  int sv[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  const int sent[3] = {eventfd(0, 0), eventfd(0, 0), eventfd(0, 0)};
+
+  // received descriptors take the lowest free numbers, after a rejected
+  // set all of them must be free again
+  const int lowest = dup(sv[0]);
+  close(lowest);
+
+  ASSERT_EQ(send_fds(sv[0], sent, 3), 0);
+  int got[2];
+  EXPECT_EQ(recv_fds(sv[1], got, 2), -1);
+  int probes[3];
+  for (int i = 0; i < 3; ++i) {
+    probes[i] = dup(sv[0]);
+    EXPECT_EQ(probes[i], lowest + i);
+  }
+  for (int fd : probes) {
+    close(fd);
+  }
+
+  ASSERT_EQ(send_fds(sv[0], sent, 2), 0);
+  EXPECT_EQ(recv_fds(sv[1], got, 2), 2);
+  close(got[0]);
+  close(got[1]);
+
+  for (int fd : sent) {
+    close(fd);
+  }
+  close(sv[0]);
+  close(sv[1]);
+  log_flush();
+}
+
+static std::vector<std::string> g_log;
+
+TEST(log, sink_rate_limit_and_level) {
+  log_set_sink([](int level, const char* msg, void* arg) {
+    g_log.push_back(msg);
+  }, nullptr);
+  log_set_rate_limit(3);
+
+  EXPECT_EQ(epoll_ctl_add(-1, -1, 0), -1);
+  log_flush();
+  ASSERT_EQ(g_log.size(), 1u);
+  EXPECT_EQ(g_log[0], "epoll_ctl error: Bad file descriptor");
+
+  // a single call site is capped per second, a window boundary may fall
+  // in between and allow one more batch
+  g_log.clear();
+  for (int i = 0; i < 100; ++i) {
+    client_write(nullptr, "x", 1);
+  }
+  log_flush();
+  EXPECT_GE(g_log.size(), 3u);
+  EXPECT_LE(g_log.size(), 6u);
+
+  g_log.clear();
+  log_set_level(LOG_LEVEL_OFF);
+  epoll_ctl_add(-1, -1, 0);
+  log_flush();
+  EXPECT_TRUE(g_log.empty());
+
+  log_set_level(LOG_LEVEL_WARN);
+  log_set_rate_limit(100);
+  log_set_sink(nullptr, nullptr);
+}
+
+TEST(log, sink_may_log_from_new_thread) {
+  // a thread logging for the first time registers its ring, which must not
+  // wait for a flush that is busy in the sink
+  log_set_sink([](int level, const char* msg, void* arg) {
+    g_log.push_back(msg);
+    if (g_log.size() == 1) {
+      auto logged = std::async(std::launch::async,
+                               [] { client_write(nullptr, "x", 1); });
+      EXPECT_EQ(logged.wait_for(std::chrono::seconds(5)),
+                std::future_status::ready);
+    }
+  }, nullptr);
+
+  g_log.clear();
+  epoll_ctl_add(-1, -1, 0);
+  log_flush();
+  log_flush();
+  ASSERT_EQ(g_log.size(), 2u);
+  EXPECT_EQ(g_log[1].rfind("socev_write err: invalid client info", 0), 0u);
+
+  log_set_sink(nullptr, nullptr);
+}
+
 int main(int argc, char* argv[]) {
+  // sendfile, splice and OpenSSL leave SIGPIPE to the application
+  signal(SIGPIPE, SIG_IGN);
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }